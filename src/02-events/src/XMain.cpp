@@ -1,5 +1,6 @@
 #include "CrossWindow/CrossWindow.h"
 #include "Renderer.h"
+#include "EventCoalescer.h"
 
 void xmain(int argc, const char** argv)
 {
@@ -17,37 +18,35 @@ void xmain(int argc, const char** argv)
     window.create(windowDesc, eventQueue);
 
     // 🏁 Engine loop
+    EventCoalescer eventCoalescer;
     bool isRunning = true;
     while (isRunning)
     {
         // ♻️ Update the event queue
         eventQueue.update();
 
-        // 🎈 Iterate through that queue:
-        while (!eventQueue.empty())
+        // 🎈 Iterate through that queue, with back to back mouse moves, wheel turns or resizes merged into one event:
+        for (const xwin::Event& event : eventCoalescer.drain(eventQueue))
         {
-            //Update Events
-            const xwin::Event& event = eventQueue.front();
-
             // Mouse Input
             if (event.type == xwin::EventType::MouseInput)
             {
                 const xwin::MouseInputData data = event.data.mouseInput;
             }
 
-            // Mouse Wheel
+            // Mouse Wheel, the sum of a run of turns
             if (event.type == xwin::EventType::MouseWheel)
             {
 
             }
 
-            // Mouse Movement
+            // Mouse Movement, the latest position along with the sum of a run of deltas
             if (event.type == xwin::EventType::MouseMove)
             {
                 const xwin::MouseMoveData data = event.data.mouseMove;
             }
 
-            // Resize
+            // Resize, the latest size
             if (event.type == xwin::EventType::Resize)
             {
                 const xwin::ResizeData data = event.data.resize;
@@ -58,8 +57,6 @@ void xmain(int argc, const char** argv)
             {
                 window.close();
             }
-
-            eventQueue.pop();
         }
     }
 
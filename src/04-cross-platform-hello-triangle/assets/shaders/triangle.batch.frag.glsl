@@ -0,0 +1,10 @@
+#version 430 core
+
+layout(location = 0) out vec4 outFragColor;
+layout(location = 0) in vec3 inColor;
+
+void main()
+{
+    outFragColor = vec4(inColor, 1.0);
+}
+
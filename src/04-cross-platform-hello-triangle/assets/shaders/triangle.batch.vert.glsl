@@ -0,0 +1,19 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+
+// One model view projection matrix per command of the multi-draw, gl_DrawIDARB says which command this vertex came from
+layout(binding = 1, std430) readonly buffer DrawData
+{
+    mat4 modelViewProjection[];
+} draws;
+
+layout(location = 0) out vec3 outColor;
+layout(location = 1) in vec3 inColor;
+layout(location = 0) in vec3 inPos;
+
+void main()
+{
+    outColor = inColor;
+    gl_Position = draws.modelViewProjection[gl_DrawIDARB] * vec4(inPos, 1.0);
+}
+
@@ -0,0 +1,24 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+
+// Per-instance stream, one matrix per instance takes locations 2 to 5
+layout (location = 2) in mat4 inModelViewProjection;
+
+layout (location = 0) out vec3 outColor;
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+
+void main() 
+{
+	outColor = inColor;
+	gl_Position = inModelViewProjection * vec4(inPos.xyz, 1.0);
+}
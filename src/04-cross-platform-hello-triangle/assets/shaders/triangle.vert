@@ -8,9 +8,7 @@ layout (location = 1) in vec3 inColor;
 
 layout (binding = 0) uniform UBO 
 {
-	mat4 projectionMatrix;
-	mat4 modelMatrix;
-	mat4 viewMatrix;
+	mat4 modelViewProjection;
 } ubo;
 
 layout (location = 0) out vec3 outColor;
@@ -24,5 +22,5 @@ out gl_PerVertex
 void main() 
 {
 	outColor = inColor;
-	gl_Position = ubo.projectionMatrix * ubo.viewMatrix * ubo.modelMatrix * vec4(inPos.xyz, 1.0);
+	gl_Position = ubo.modelViewProjection * vec4(inPos.xyz, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+# Writes OUTPUT, a C++ source that embeds each of FILES (a ;-separated list) as a constexpr byte array.
+# usage: cmake -DOUTPUT=<file.cpp> -DFILES=<a;b;c> -P EmbedShaders.cmake
+
+set(ARRAYS "")
+set(ENTRIES "")
+
+foreach(FILE IN LISTS FILES)
+    get_filename_component(NAME ${FILE} NAME)
+    string(MAKE_C_IDENTIFIER ${NAME} IDENTIFIER)
+    file(SIZE ${FILE} SIZE)
+    file(READ ${FILE} HEX HEX)
+
+    # A trailing 0 keeps empty files valid arrays, and lets text shaders be used as C strings
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${HEX}")
+    string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n\t" BYTES "${BYTES}")
+
+    string(APPEND ARRAYS "constexpr unsigned char ${IDENTIFIER}[] =\n{\n\t${BYTES}0x00\n};\n\n")
+    string(APPEND ENTRIES "\t{ \"${NAME}\", ${IDENTIFIER}, ${SIZE} },\n")
+endforeach()
+
+list(LENGTH FILES COUNT)
+
+set(SOURCE "// Generated by cmake/EmbedShaders.cmake, do not edit\n\n#include \"EmbeddedShaders.h\"\n\nnamespace\n{\n\n${ARRAYS}}\n\n")
+string(APPEND SOURCE "const EmbeddedShader EmbeddedShaders[] =\n{\n${ENTRIES}\t{ nullptr, nullptr, 0 }\n};\n\n")
+string(APPEND SOURCE "const size_t EmbeddedShaderCount = ${COUNT};\n")
+
+# Only touch the file when it changes, so an unchanged shader doesn't relink the app
+file(WRITE ${OUTPUT}.tmp "${SOURCE}")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
@@ -12,7 +12,7 @@ inline void ThrowIfFailed(HRESULT hr)
 
 // Renderer
 
-Renderer::Renderer(xwin::Window& window)
+Renderer::Renderer(xwin::Window& window, const RendererDesc& desc) : mDesc(desc)
 {
 	mVsync = true;
 	mWindow = nullptr;
@@ -45,7 +45,7 @@ Renderer::Renderer(xwin::Window& window)
 	initializeAPI(window);
 	resize(mWidth, mHeight);
 	initializeResources();
-	tStart = std::chrono::high_resolution_clock::now();
+	mFramePacer.setTargetFrameRate(mDesc.targetFrameRate);
 }
 
 Renderer::~Renderer()
@@ -187,21 +187,14 @@ void Renderer::initializeResources()
 #else
 	UINT compileFlags = 0;
 #endif
-	std::string path = "";
-	char pBuf[1024];
-
-	_getcwd(pBuf, 1024);
-	path = pBuf;
-	path += "\\";
-	std::wstring wpath = std::wstring(path.begin(), path.end());
-
-	std::wstring vertPath = wpath + L"assets/shaders/triangle.vert.hlsl";
-	std::wstring fragPath = wpath + L"assets/shaders/triangle.frag.hlsl";
+	// Embedded in the executable, or read from disk when shaders aren't embedded / are overridden
+	std::vector<char> vertSource = readShader("assets/shaders/triangle.vert.hlsl");
+	std::vector<char> fragSource = readShader("assets/shaders/triangle.frag.hlsl");
 
 	try
 	{
-		ThrowIfFailed(D3DCompileFromFile(vertPath.c_str(), nullptr, nullptr, "main", "vs_5_0", compileFlags, 0, &vertexShader, &errors));
-		ThrowIfFailed(D3DCompileFromFile(fragPath.c_str(), nullptr, nullptr, "main", "ps_5_0", compileFlags, 0, &pixelShader, &errors));
+		ThrowIfFailed(D3DCompile(vertSource.data(), vertSource.size(), "triangle.vert.hlsl", nullptr, nullptr, "main", "vs_5_0", compileFlags, 0, &vertexShader, &errors));
+		ThrowIfFailed(D3DCompile(fragSource.data(), fragSource.size(), "triangle.frag.hlsl", nullptr, nullptr, "main", "ps_5_0", compileFlags, 0, &pixelShader, &errors));
 	}
 	catch (std::exception e)
 	{
@@ -486,11 +479,11 @@ void Renderer::setupSwapchain(unsigned width, unsigned height)
 	float zoom = -2.5f;
 
 	// Update matrices
-	uboVS.projectionMatrix = Matrix4::perspective(45.0f, static_cast<float>(mWidth) / static_cast<float>(mHeight), 0.01f, 1024.0f);
+	mProjectionMatrix = Matrix4::perspective(45.0f, static_cast<float>(mWidth) / static_cast<float>(mHeight), 0.01f, 1024.0f);
 
-	uboVS.viewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom)) * Matrix4::rotationZ(3.14f);
+	mViewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom)) * Matrix4::rotationZ(3.14f);
 
-	uboVS.modelMatrix = Matrix4::identity();
+	mModelMatrix = Matrix4::identity();
 
 	if (mSwapchain != nullptr)
 	{
@@ -556,20 +549,23 @@ void Renderer::resize(unsigned width, unsigned height)
 
 void Renderer::render()
 {
-	// Framelimit set to 60 fps
-	tEnd = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::milli>(tEnd - tStart).count();
-	if (time < (1000.0f / 60.0f))
+	mProfiler.nextFrame();
+
+	// Sleep until the frame pacer says the next frame is due, rather than spinning on the clock
+	float time;
 	{
-		return;
+		ProfileScope scope(mProfiler, "Frame Pacing");
+		time = mFramePacer.waitForNextFrame();
 	}
-	tStart = std::chrono::high_resolution_clock::now();
 
 	{
 		// Update Uniforms
+		ProfileScope scope(mProfiler, "Uniform Update");
+
 		mElapsedTime += 0.001f * time;
 		mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
-		uboVS.modelMatrix = Matrix4::rotationY(mElapsedTime);
+		mModelMatrix = Matrix4::rotationY(mElapsedTime);
+		uboVS.modelViewProjection = mProjectionMatrix * mViewMatrix * mModelMatrix;
 
 		D3D11_MAPPED_SUBRESOURCE mappedResource;
 		unsigned int bufferNumber;
@@ -592,6 +588,8 @@ void Renderer::render()
 
 	}
 
+	ProfileScope submitScope(mProfiler, "Submit");
+
 	float color[4] = { 0.2f, 0.2f, 0.2f, 1.0f };
 	mDeviceContext->ClearRenderTargetView(mRenderTargetView, color);
 
@@ -619,6 +617,9 @@ void Renderer::render()
 	// Render the assets/shaders/triangle.
 	mDeviceContext->DrawIndexed(3, 0, 0);
 
+	ProfileScope presentScope(mProfiler, "Present");
+
+	FramePacer::Clock::time_point presentStart = FramePacer::Clock::now();
 	if (mVsync)
 	{
 		mSwapchain->Present(1, 0);
@@ -627,6 +628,7 @@ void Renderer::render()
 	{
 		mSwapchain->Present(0, 0);
 	}
+	mFramePacer.onPresent(presentStart);
 }
 
 /**
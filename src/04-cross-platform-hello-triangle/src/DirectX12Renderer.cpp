@@ -12,7 +12,7 @@ inline void ThrowIfFailed(HRESULT hr)
 
 // Renderer
 
-Renderer::Renderer(xwin::Window& window)
+Renderer::Renderer(xwin::Window& window, const RendererDesc& desc) : mDesc(desc)
 {
 	mWindow;
 
@@ -52,7 +52,7 @@ Renderer::Renderer(xwin::Window& window)
 	initializeAPI(window);
 	initializeResources();
 	setupCommands();
-	tStart = std::chrono::high_resolution_clock::now();
+	mFramePacer.setTargetFrameRate(mDesc.targetFrameRate);
 }
 
 Renderer::~Renderer()
@@ -328,21 +328,14 @@ void Renderer::initializeResources()
 #else
 		UINT compileFlags = 0;
 #endif
-		std::string path = "";
-		char pBuf[1024];
-
-		_getcwd(pBuf, 1024);
-		path = pBuf;
-		path += "\\";
-		std::wstring wpath = std::wstring(path.begin(), path.end());
-
-		std::wstring vertPath = wpath + L"assets/shaders/triangle.vert.hlsl";
-		std::wstring fragPath = wpath + L"assets/shaders/triangle.frag.hlsl";
+		// Embedded in the executable, or read from disk when shaders aren't embedded / are overridden
+		std::vector<char> vertSource = readShader("assets/shaders/triangle.vert.hlsl");
+		std::vector<char> fragSource = readShader("assets/shaders/triangle.frag.hlsl");
 
 		try
 		{
-			ThrowIfFailed(D3DCompileFromFile(vertPath.c_str(), nullptr, nullptr, "main", "vs_5_0", compileFlags, 0, &vertexShader, &errors));
-			ThrowIfFailed(D3DCompileFromFile(fragPath.c_str(), nullptr, nullptr, "main", "ps_5_0", compileFlags, 0, &pixelShader, &errors));
+			ThrowIfFailed(D3DCompile(vertSource.data(), vertSource.size(), "triangle.vert.hlsl", nullptr, nullptr, "main", "vs_5_0", compileFlags, 0, &vertexShader, &errors));
+			ThrowIfFailed(D3DCompile(fragSource.data(), fragSource.size(), "triangle.frag.hlsl", nullptr, nullptr, "main", "ps_5_0", compileFlags, 0, &pixelShader, &errors));
 		}
 		catch (std::exception e)
 		{
@@ -794,11 +787,11 @@ void Renderer::setupSwapchain(unsigned width, unsigned height)
 	float zoom = -2.5f;
 
 	// Update matrices
-	uboVS.projectionMatrix = Matrix4::perspective(45.0f, mViewport.Width / mViewport.Height, 0.01f, 1024.0f);
+	mProjectionMatrix = Matrix4::perspective(45.0f, mViewport.Width / mViewport.Height, 0.01f, 1024.0f);
 
-	uboVS.viewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom)) * Matrix4::rotationZ(3.14f);
+	mViewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom)) * Matrix4::rotationZ(3.14f);
 
-	uboVS.modelMatrix = Matrix4::identity();
+	mModelMatrix = Matrix4::identity();
 
 	if (mSwapchain != nullptr)
 	{
@@ -854,20 +847,23 @@ void Renderer::resize(unsigned width, unsigned height)
 
 void Renderer::render()
 {
-	// Framelimit set to 60 fps
-	tEnd = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::milli>(tEnd - tStart).count();
-	if (time < (1000.0f / 60.0f))
+	mProfiler.nextFrame();
+
+	// Sleep until the frame pacer says the next frame is due, rather than spinning on the clock
+	float time;
 	{
-		return;
+		ProfileScope scope(mProfiler, "Frame Pacing");
+		time = mFramePacer.waitForNextFrame();
 	}
-	tStart = std::chrono::high_resolution_clock::now();
 
 	{
 		// Update Uniforms
+		ProfileScope scope(mProfiler, "Uniform Update");
+
 		mElapsedTime += 0.001f * time;
 		mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
-		uboVS.modelMatrix = Matrix4::rotationY(mElapsedTime);
+		mModelMatrix = Matrix4::rotationY(mElapsedTime);
+		uboVS.modelViewProjection = mProjectionMatrix * mViewMatrix * mModelMatrix;
 
 		D3D12_RANGE readRange;
 		readRange.Begin = 0;
@@ -878,13 +874,24 @@ void Renderer::render()
 		mUniformBuffer->Unmap(0, &readRange);
 	}
 
-	// Record all the commands we need to render the scene into the command list.
-	setupCommands();
+	{
+		ProfileScope scope(mProfiler, "Submit");
+
+		// Record all the commands we need to render the scene into the command list.
+		setupCommands();
 
-	// Execute the command list.
-	ID3D12CommandList* ppCommandLists[] = { mCommandList };
-	mCommandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
-	mSwapchain->Present(1, 0);
+		// Execute the command list.
+		ID3D12CommandList* ppCommandLists[] = { mCommandList };
+		mCommandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+	}
+
+	{
+		ProfileScope scope(mProfiler, "Present");
+
+		FramePacer::Clock::time_point presentStart = FramePacer::Clock::now();
+		mSwapchain->Present(1, 0);
+		mFramePacer.onPresent(presentStart);
+	}
 
 	// WAITING FOR THE FRAME TO COMPLETE BEFORE CONTINUING IS NOT BEST PRACTICE.
 
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// Embedded Shaders
+
+// A compiled shader linked into the executable, see cmake/EmbedShaders.cmake
+struct EmbeddedShader
+{
+	// File name in assets/shaders/, such as triangle.vert.spv
+	const char* name;
+	const unsigned char* data;
+	size_t size;
+};
+
+// Followed by an entry with a null name
+extern const EmbeddedShader EmbeddedShaders[];
+extern const size_t EmbeddedShaderCount;
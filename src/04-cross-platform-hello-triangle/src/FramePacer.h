@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+// Frame Pacer
+
+/**
+ * Blocks the render loop until the next frame is due. It sleeps through most of the wait
+ * and only spins for the last stretch, so hitting the deadline doesn't burn a whole core.
+ * The spin stretch adapts to how much the OS oversleeps. Frames are scheduled on a fixed
+ * cadence instead of "now + interval", so small delays don't accumulate into drift.
+ */
+class FramePacer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	FramePacer()
+	{
+		mInterval = Clock::duration::zero();
+		mSpinThreshold = std::chrono::microseconds(2000);
+		mPresentTime = Clock::duration::zero();
+		mMissedFrames = 0;
+		mLastFrame = Clock::now();
+		mNextFrame = mLastFrame;
+	}
+
+	// Frames per second to target, 0 or less renders uncapped (benchmark mode)
+	void setTargetFrameRate(float framesPerSecond)
+	{
+		mInterval = framesPerSecond > 0.0f ?
+			std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond)) :
+			Clock::duration::zero();
+		mNextFrame = Clock::now() + mInterval;
+	}
+
+	// Wait until the next frame is due, returns milliseconds since the previous frame started
+	float waitForNextFrame()
+	{
+		Clock::time_point now = Clock::now();
+
+		if (mInterval > Clock::duration::zero())
+		{
+			// Sleep for the bulk of the wait, the OS may overshoot so leave some room
+			Clock::duration remaining = mNextFrame - now;
+			if (remaining > mSpinThreshold)
+			{
+				Clock::duration sleepTime = remaining - mSpinThreshold;
+				std::this_thread::sleep_for(sleepTime);
+
+				Clock::time_point woke = Clock::now();
+				Clock::duration oversleep = (woke - now) - sleepTime;
+				updateSpinThreshold(oversleep);
+				now = woke;
+			}
+
+			// Spin the last stretch, yielding so other threads can still run
+			while (now < mNextFrame)
+			{
+				std::this_thread::yield();
+				now = Clock::now();
+			}
+
+			// If we fell more than a frame behind, start a new cadence instead of rushing to catch up
+			mNextFrame += mInterval;
+			if (mNextFrame < now)
+			{
+				mNextFrame = now + mInterval;
+				mMissedFrames++;
+			}
+		}
+
+		float elapsed = std::chrono::duration<float, std::milli>(now - mLastFrame).count();
+		mLastFrame = now;
+		return elapsed;
+	}
+
+	// Report when the present / swap call started, right after it returns
+	void onPresent(Clock::time_point presentStart)
+	{
+		Clock::time_point presentEnd = Clock::now();
+
+		// Running average of how long presents block, high values mean vsync is already pacing us
+		mPresentTime = (mPresentTime * 7 + (presentEnd - presentStart)) / 8;
+
+		// A present that blocks past the next deadline means the display is slower than our target,
+		// so line the cadence up with the display rather than firing the next frame immediately
+		if (mInterval > Clock::duration::zero() && presentEnd > mNextFrame)
+		{
+			mNextFrame = presentEnd;
+		}
+	}
+
+	// Target milliseconds per frame, 0 when uncapped
+	float getTargetFrameTime() const
+	{
+		return std::chrono::duration<float, std::milli>(mInterval).count();
+	}
+
+	// Average milliseconds spent blocked in present
+	float getPresentTime() const
+	{
+		return std::chrono::duration<float, std::milli>(mPresentTime).count();
+	}
+
+	// Frames that started later than a full interval past their deadline
+	unsigned getMissedFrames() const
+	{
+		return mMissedFrames;
+	}
+
+protected:
+	void updateSpinThreshold(Clock::duration oversleep)
+	{
+		// Keep the spin stretch a little above the worst oversleep we've seen recently
+		Clock::duration target = oversleep + oversleep / 2 + std::chrono::microseconds(250);
+		mSpinThreshold = (mSpinThreshold * 7 + target) / 8;
+		mSpinThreshold = std::max<Clock::duration>(std::min<Clock::duration>(mSpinThreshold, std::chrono::microseconds(4000)), std::chrono::microseconds(500));
+	}
+
+	Clock::duration mInterval;
+	Clock::duration mSpinThreshold;
+	Clock::duration mPresentTime;
+	Clock::time_point mNextFrame;
+	Clock::time_point mLastFrame;
+	unsigned mMissedFrames;
+};
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+
+// Frame Profiler
+
+struct FrameStats
+{
+	unsigned frameCount = 0;
+	float average = 0.0f;
+	float minimum = 0.0f;
+	float maximum = 0.0f;
+	float p50 = 0.0f;
+	float p95 = 0.0f;
+	float p99 = 0.0f;
+};
+
+/**
+ * Cheap enough to leave on in release builds. Each frame stores a handful of named CPU
+ * scopes (names must be string literals or otherwise outlive the profiler) along with any
+ * GPU times the backend reads back. Frame times feed a rolling histogram so percentiles
+ * cost O(buckets) instead of a sort, and the last few seconds of frames can be exported
+ * as CSV or as a Chrome trace (chrome://tracing, https://ui.perfetto.dev).
+ */
+class FrameProfiler
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static const size_t HistoryLength = 600;
+	static const size_t MaxEventsPerFrame = 32;
+
+	// Rolling histogram of 0.1 ms buckets, the last one catches everything at or past 100 ms
+	static const size_t BucketCount = 1001;
+	static constexpr float BucketWidth = 0.1f;
+
+	enum class Track
+	{
+		CPU,
+		GPU
+	};
+
+	struct Event
+	{
+		const char* name;
+		Track track;
+		float start;
+		float duration;
+	};
+
+	struct Frame
+	{
+		uint64_t index;
+		float start;
+		float duration;
+		size_t eventCount;
+		Event events[MaxEventsPerFrame];
+	};
+
+	FrameProfiler()
+	{
+		mOrigin = Clock::now();
+		mFrames.resize(HistoryLength);
+		mHistogram.resize(BucketCount, 0);
+		mFrameCount = 0;
+		mScopeDepth = 0;
+		beginFrame(0.0f);
+	}
+
+	// Close the current frame and start the next one, call once per frame before any scopes
+	void nextFrame()
+	{
+		float now = toMilliseconds(Clock::now());
+		Frame& frame = currentFrame();
+		frame.duration = now - frame.start;
+
+		// The oldest frame falls out of the rolling window once the history is full
+		if (mFrameCount + 1 >= HistoryLength)
+		{
+			mHistogram[getBucket(mFrames[(mFrameCount + 1) % HistoryLength].duration)]--;
+		}
+		mHistogram[getBucket(frame.duration)]++;
+
+		mFrameCount++;
+		beginFrame(now);
+	}
+
+	// Index of the frame currently being recorded, used to attribute late GPU results
+	uint64_t getFrameIndex() const
+	{
+		return mFrameCount;
+	}
+
+	void beginScope(const char* name)
+	{
+		if (mScopeDepth < MaxScopeDepth)
+		{
+			mScopeStack[mScopeDepth] = addEvent(name, Track::CPU, toMilliseconds(Clock::now()), 0.0f);
+		}
+		mScopeDepth++;
+	}
+
+	void endScope()
+	{
+		mScopeDepth--;
+		if (mScopeDepth < MaxScopeDepth && mScopeStack[mScopeDepth] != nullptr)
+		{
+			Event* e = mScopeStack[mScopeDepth];
+			e->duration = toMilliseconds(Clock::now()) - e->start;
+		}
+	}
+
+	// GPU work is read back a few frames late, framesAgo says which frame it belongs to
+	void addGpuTime(const char* name, float start, float duration, unsigned framesAgo)
+	{
+		if (framesAgo >= HistoryLength || framesAgo > mFrameCount)
+		{
+			return;
+		}
+
+		Frame& frame = mFrames[(mFrameCount - framesAgo) % HistoryLength];
+		if (frame.eventCount < MaxEventsPerFrame)
+		{
+			frame.events[frame.eventCount++] = Event{ name, Track::GPU, frame.start + start, duration };
+		}
+	}
+
+	// Frame time percentiles over the rolling window, in milliseconds
+	FrameStats getStats() const
+	{
+		FrameStats stats;
+		size_t count = std::min<size_t>(static_cast<size_t>(mFrameCount), HistoryLength - 1);
+		if (count == 0)
+		{
+			return stats;
+		}
+
+		stats.frameCount = static_cast<unsigned>(count);
+		stats.minimum = 1e9f;
+		for (size_t i = 0; i < count; ++i)
+		{
+			float duration = mFrames[(mFrameCount - 1 - i) % HistoryLength].duration;
+			stats.average += duration;
+			stats.minimum = std::min(stats.minimum, duration);
+			stats.maximum = std::max(stats.maximum, duration);
+		}
+		stats.average /= static_cast<float>(count);
+
+		stats.p50 = getPercentile(count, 0.50f);
+		stats.p95 = getPercentile(count, 0.95f);
+		stats.p99 = getPercentile(count, 0.99f);
+		return stats;
+	}
+
+	// Average milliseconds per frame spent in a scope, GPU times are named "GPU <name>" as in the CSV
+	float getAverageTime(const std::string& name) const
+	{
+		float total = 0.0f;
+		unsigned frames = 0;
+		forEachFrame([&](const Frame& frame)
+		{
+			bool found = false;
+			for (size_t i = 0; i < frame.eventCount; ++i)
+			{
+				if (getEventName(frame.events[i]) == name)
+				{
+					total += frame.events[i].duration;
+					found = true;
+				}
+			}
+			frames += found ? 1 : 0;
+		});
+		return frames > 0 ? total / static_cast<float>(frames) : 0.0f;
+	}
+
+	// Every scope name in the history, in the order they first appear, GPU ones prefixed with "GPU "
+	std::vector<std::string> getEventNames() const
+	{
+		std::vector<std::string> names;
+		forEachFrame([&](const Frame& frame)
+		{
+			for (size_t i = 0; i < frame.eventCount; ++i)
+			{
+				std::string name = getEventName(frame.events[i]);
+				if (std::find(names.begin(), names.end(), name) == names.end())
+				{
+					names.push_back(name);
+				}
+			}
+		});
+		return names;
+	}
+
+	// One row per frame, one column per scope name with its total milliseconds that frame
+	bool exportCSV(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		std::vector<std::string> columns = getEventNames();
+
+		file << "frame,frameTime";
+		for (const std::string& column : columns)
+		{
+			file << "," << column;
+		}
+		file << "\n";
+
+		forEachFrame([&](const Frame& frame)
+		{
+			file << frame.index << "," << frame.duration;
+			for (const std::string& column : columns)
+			{
+				float total = 0.0f;
+				for (size_t i = 0; i < frame.eventCount; ++i)
+				{
+					if (getEventName(frame.events[i]) == column)
+					{
+						total += frame.events[i].duration;
+					}
+				}
+				file << "," << total;
+			}
+			file << "\n";
+		});
+		return true;
+	}
+
+	// Chrome trace event format, CPU scopes and GPU work show up as two tracks
+	bool exportChromeTrace(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		file << "{\"traceEvents\":[\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+
+		forEachFrame([&](const Frame& frame)
+		{
+			file << ",\n{\"name\":\"Frame " << frame.index << "\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":"
+				<< frame.start * 1000.0f << ",\"dur\":" << frame.duration * 1000.0f << "}";
+
+			for (size_t i = 0; i < frame.eventCount; ++i)
+			{
+				const Event& e = frame.events[i];
+				file << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (e.track == Track::CPU ? 1 : 2)
+					<< ",\"ts\":" << e.start * 1000.0f << ",\"dur\":" << e.duration * 1000.0f << "}";
+			}
+		});
+
+		file << "\n]}\n";
+		return true;
+	}
+
+protected:
+	static const size_t MaxScopeDepth = 8;
+
+	float toMilliseconds(Clock::time_point t) const
+	{
+		return std::chrono::duration<float, std::milli>(t - mOrigin).count();
+	}
+
+	Frame& currentFrame()
+	{
+		return mFrames[mFrameCount % HistoryLength];
+	}
+
+	void beginFrame(float start)
+	{
+		Frame& frame = currentFrame();
+		frame.index = mFrameCount;
+		frame.start = start;
+		frame.duration = 0.0f;
+		frame.eventCount = 0;
+	}
+
+	Event* addEvent(const char* name, Track track, float start, float duration)
+	{
+		Frame& frame = currentFrame();
+		if (frame.eventCount >= MaxEventsPerFrame)
+		{
+			return nullptr;
+		}
+		frame.events[frame.eventCount] = Event{ name, track, start, duration };
+		return &frame.events[frame.eventCount++];
+	}
+
+	static size_t getBucket(float milliseconds)
+	{
+		return std::min(static_cast<size_t>(std::max(milliseconds, 0.0f) / BucketWidth), BucketCount - 1);
+	}
+
+	float getPercentile(size_t count, float percentile) const
+	{
+		size_t target = static_cast<size_t>(percentile * static_cast<float>(count - 1));
+		size_t seen = 0;
+		for (size_t i = 0; i < BucketCount; ++i)
+		{
+			seen += mHistogram[i];
+			if (seen > target)
+			{
+				// Report the middle of the bucket
+				return (static_cast<float>(i) + 0.5f) * BucketWidth;
+			}
+		}
+		return static_cast<float>(BucketCount) * BucketWidth;
+	}
+
+	static std::string getEventName(const Event& e)
+	{
+		return e.track == Track::GPU ? std::string("GPU ") + e.name : std::string(e.name);
+	}
+
+	// Completed frames in the history, oldest first
+	template <typename Func>
+	void forEachFrame(Func func) const
+	{
+		size_t count = std::min<size_t>(static_cast<size_t>(mFrameCount), HistoryLength - 1);
+		for (size_t i = count; i > 0; --i)
+		{
+			func(mFrames[(mFrameCount - i) % HistoryLength]);
+		}
+	}
+
+	Clock::time_point mOrigin;
+	std::vector<Frame> mFrames;
+	std::vector<unsigned> mHistogram;
+	uint64_t mFrameCount;
+
+	Event* mScopeStack[MaxScopeDepth];
+	size_t mScopeDepth;
+};
+
+// Times the enclosing block as a CPU scope of the current frame
+class ProfileScope
+{
+public:
+	ProfileScope(FrameProfiler& profiler, const char* name) : mProfiler(profiler)
+	{
+		mProfiler.beginScope(name);
+	}
+
+	~ProfileScope()
+	{
+		mProfiler.endScope();
+	}
+
+protected:
+	FrameProfiler& mProfiler;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "FrameProfiler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+// Latency Tracker
+
+/**
+ * Input to photon latency. The app reports when input reached it, such as when the event pump returned it,
+ * and the renderer tags the next frame it builds with the oldest input that frame is the first to show. Once
+ * that frame's present call returns, and again when the swapchain says it reached the display (where the
+ * backend can tell, such as with VK_GOOGLE_display_timing), the time since the input becomes a sample.
+ * Percentiles are over the last HistoryLength tagged frames, so present modes and frame pacing settings can
+ * be compared on the same run length.
+ */
+class LatencyTracker
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static const size_t HistoryLength = 4096;
+
+	// Input reached the app at time, only the oldest input since the last tagged frame counts
+	void addInput(Clock::time_point time)
+	{
+		if (!mHasInput)
+		{
+			mInputTime = time;
+			mHasInput = true;
+		}
+	}
+
+	// Tag the frame being built with the pending input, returns the tag to hand to present, 0 if there's no new input
+	uint32_t tagFrame()
+	{
+		if (!mHasInput)
+		{
+			return 0;
+		}
+		mHasInput = false;
+
+		// 0 means untagged, so it's skipped when the tags wrap around
+		mLastTag = mLastTag == UINT32_MAX ? 1 : mLastTag + 1;
+		mFrames.push_back(TaggedFrame{ mLastTag, mInputTime });
+
+		// Frames the display never reports on are dropped once they're well out of the swapchain
+		if (mFrames.size() > MaxTaggedFrames)
+		{
+			mFrames.pop_front();
+		}
+		return mLastTag;
+	}
+
+	// The present / swap call of a tagged frame returned at time
+	void onPresented(uint32_t tag, Clock::time_point time)
+	{
+		const TaggedFrame* frame = findFrame(tag);
+		if (frame != nullptr)
+		{
+			addSample(mPresentSamples, mPresentCount, time - frame->inputTime);
+		}
+	}
+
+	// A tagged frame reached the display at time
+	void onDisplayed(uint32_t tag, Clock::time_point time)
+	{
+		const TaggedFrame* frame = findFrame(tag);
+		if (frame != nullptr)
+		{
+			addSample(mDisplaySamples, mDisplayCount, time - frame->inputTime);
+		}
+	}
+
+	// Milliseconds from input until the present call returned, frameCount is the number of tagged frames
+	FrameStats getPresentStats() const
+	{
+		return getStats(mPresentSamples);
+	}
+
+	// Milliseconds from input until the frame was displayed, empty if the backend can't tell when that is
+	FrameStats getDisplayStats() const
+	{
+		return getStats(mDisplaySamples);
+	}
+
+protected:
+	static const size_t MaxTaggedFrames = 64;
+
+	struct TaggedFrame
+	{
+		uint32_t tag;
+		Clock::time_point inputTime;
+	};
+
+	const TaggedFrame* findFrame(uint32_t tag) const
+	{
+		for (const TaggedFrame& frame : mFrames)
+		{
+			if (frame.tag == tag)
+			{
+				return &frame;
+			}
+		}
+		return nullptr;
+	}
+
+	// Samples are a rolling window, count says where the next one goes once it's full
+	static void addSample(std::vector<float>& samples, size_t& count, Clock::duration latency)
+	{
+		float milliseconds = std::chrono::duration<float, std::milli>(latency).count();
+		if (samples.size() < HistoryLength)
+		{
+			samples.push_back(milliseconds);
+		}
+		else
+		{
+			samples[count % HistoryLength] = milliseconds;
+		}
+		++count;
+	}
+
+	// Only computed for reports, so an exact sort is fine
+	static FrameStats getStats(const std::vector<float>& samples)
+	{
+		FrameStats stats;
+		if (samples.empty())
+		{
+			return stats;
+		}
+
+		std::vector<float> sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+
+		stats.frameCount = static_cast<unsigned>(sorted.size());
+		for (float sample : sorted)
+		{
+			stats.average += sample;
+		}
+		stats.average /= static_cast<float>(sorted.size());
+		stats.minimum = sorted.front();
+		stats.maximum = sorted.back();
+
+		auto percentile = [&](float p) { return sorted[static_cast<size_t>(p * static_cast<float>(sorted.size() - 1))]; };
+		stats.p50 = percentile(0.50f);
+		stats.p95 = percentile(0.95f);
+		stats.p99 = percentile(0.99f);
+		return stats;
+	}
+
+	bool mHasInput = false;
+	Clock::time_point mInputTime;
+	uint32_t mLastTag = 0;
+	std::deque<TaggedFrame> mFrames;
+
+	std::vector<float> mPresentSamples;
+	size_t mPresentCount = 0;
+	std::vector<float> mDisplaySamples;
+	size_t mDisplayCount = 0;
+};
@@ -2,12 +2,12 @@
 #import <Metal/Metal.h>
 #import <QuartzCore/CAMetalLayer.h>
 
-Renderer::Renderer(xwin::Window& window)
+Renderer::Renderer(xwin::Window& window, const RendererDesc& desc) : mDesc(desc)
 {
 	initializeAPI(window);
 	initializeResources();
 	setupCommands();
-	tStart = std::chrono::high_resolution_clock::now();
+	mFramePacer.setTargetFrameRate(mDesc.targetFrameRate);
 }
 
 Renderer::~Renderer()
@@ -72,12 +72,13 @@ void Renderer::initializeResources()
 	float zoom = -2.5f;
 	
 	// Update matrices
-	uboVS.projectionMatrix = Matrix4::perspective(45.0f, (float)mViewportSize[0] / (float)mViewportSize[1], 0.01f, 1024.0f);
+	mProjectionMatrix = Matrix4::perspective(45.0f, (float)mViewportSize[0] / (float)mViewportSize[1], 0.01f, 1024.0f);
 	
-	uboVS.viewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom)) * Matrix4::rotationZ(3.14f);
+	mViewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom)) * Matrix4::rotationZ(3.14f);
 	
-	uboVS.modelMatrix = Matrix4::identity();
+	mModelMatrix = Matrix4::identity();
 	
+	uboVS.modelViewProjection = mProjectionMatrix * mViewMatrix * mModelMatrix;
 	size_t uboSize = sizeof(uboVS);
 	
 	memcpy(((id<MTLBuffer>)mUniformBuffer).contents, &uboVS, uboSize);
@@ -86,9 +87,9 @@ void Renderer::initializeResources()
 	NSError* err = nil;
 	
 	// Load shader files, add null terminator to the end.
-	std::vector<char> vertSource = readFile("triangle.vert.msl");
+	std::vector<char> vertSource = readShader("triangle.vert.msl");
 	vertSource.emplace_back(0);
-	std::vector<char> fragSource = readFile("triangle.frag.msl");
+	std::vector<char> fragSource = readShader("triangle.frag.msl");
 	fragSource.emplace_back(0);
 	
 	{
@@ -171,22 +172,29 @@ void Renderer::setupCommands()
 
 void Renderer::render()
 {
-	// Framelimit set to 60 fps
-	tEnd = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::milli>(tEnd - tStart).count();
-	if (time < (1000.0f / 60.0f))
-	{ return; }
-	tStart = std::chrono::high_resolution_clock::now();
+	mProfiler.nextFrame();
+
+	// Sleep until the frame pacer says the next frame is due, rather than spinning on the clock
+	float time;
+	{
+		ProfileScope scope(mProfiler, "Frame Pacing");
+		time = mFramePacer.waitForNextFrame();
+	}
 	
 	// Update uniforms
-	
-	mElapsedTime += 0.001f * time;
-	mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
-	
-	uboVS.modelMatrix = Matrix4::rotationY(mElapsedTime);
-	memcpy(((id<MTLBuffer>)mUniformBuffer).contents, &uboVS, sizeof(uboVS));
+	{
+		ProfileScope scope(mProfiler, "Uniform Update");
+
+		mElapsedTime += 0.001f * time;
+		mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
+
+		mModelMatrix = Matrix4::rotationY(mElapsedTime);
+		uboVS.modelViewProjection = mProjectionMatrix * mViewMatrix * mModelMatrix;
+		memcpy(((id<MTLBuffer>)mUniformBuffer).contents, &uboVS, sizeof(uboVS));
+	}
 	
 	// Create a new command buffer for each render pass to the current drawable
+	ProfileScope submitScope(mProfiler, "Submit");
 	
 	if (mCommandBuffer != nil)
 	{ [(id<MTLCommandBuffer>)mCommandBuffer release]; }
@@ -232,7 +240,10 @@ void Renderer::render()
 		
 		[(id<MTLCommandBuffer>)mCommandBuffer presentDrawable:drawable];
 		
+		ProfileScope presentScope(mProfiler, "Present");
+		FramePacer::Clock::time_point presentStart = FramePacer::Clock::now();
 		[(id<MTLCommandBuffer>)mCommandBuffer commit];
+		mFramePacer.onPresent(presentStart);
 		
 		
 	}
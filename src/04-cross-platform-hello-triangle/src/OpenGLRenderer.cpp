@@ -1,16 +1,99 @@
 ﻿#include <glad/glad.h>
 #include "Renderer.h"
 
-Renderer::Renderer(xwin::Window& window)
+#if defined(XGFX_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// OpenGL Utils
+
+// FNV-1a, plenty to tell shader sources and driver versions apart
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Program binaries only load on the driver that wrote them, so the driver strings are part of the key
+uint64_t getProgramKey(const std::vector<const std::vector<char>*>& sources)
+{
+	uint64_t key = hashBytes(nullptr, 0);
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		const char* str = reinterpret_cast<const char*>(glGetString(name));
+		if (str != nullptr)
+		{
+			key = hashBytes(str, strlen(str), key);
+		}
+	}
+	for (const std::vector<char>* source : sources)
+	{
+		key = hashBytes(source->data(), source->size(), key);
+	}
+	return key;
+}
+
+struct ProgramBinaryHeader
+{
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint32_t length;
+	uint32_t padding;
+};
+
+const uint32_t ProgramBinaryMagic = 0x42504758; // "XGPB"
+
+// Attribute locations, fixed by the layout qualifiers in triangle.vert so there's nothing to look up by name
+const GLuint PositionAttrib = 0;
+const GLuint ColorAttrib = 1;
+
+// InstanceData's matrix, a column per attribute
+const GLuint InstanceAttrib = 2;
+
+// In the same order as PipelineStatistics
+const GLenum PipelineStatisticsTargets[6] = {
+	GL_VERTICES_SUBMITTED_ARB,
+	GL_PRIMITIVES_SUBMITTED_ARB,
+	GL_VERTEX_SHADER_INVOCATIONS_ARB,
+	GL_CLIPPING_INPUT_PRIMITIVES_ARB,
+	GL_CLIPPING_OUTPUT_PRIMITIVES_ARB,
+	GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+};
+
+Renderer::Renderer(xwin::Window& window, const RendererDesc& desc) : mDesc(desc)
 {
-	xwin::WindowDesc desc = window.getDesc();
+	xwin::WindowDesc windowDesc = window.getDesc();
+	mWidth = clamp(windowDesc.width, 1u, 0xffffu);
+	mHeight = clamp(windowDesc.height, 1u, 0xffffu);
+	mOffscreen = mDesc.offscreenFrameBuffer;
+
+	initializeAPI(window);
+	initializeResources();
+	setupCommands();
+	initFrameBuffer();
+	mFramePacer.setTargetFrameRate(mDesc.targetFrameRate);
+}
+
+Renderer::Renderer(const RendererDesc& desc) : mDesc(desc)
+{
+	mHeadless = true;
+	mOffscreen = true;
 	mWidth = clamp(desc.width, 1u, 0xffffu);
 	mHeight = clamp(desc.height, 1u, 0xffffu);
 
-	initializeAPI(window);
+	initializeHeadlessAPI();
 	initializeResources();
 	setupCommands();
-	tStart = std::chrono::high_resolution_clock::now();
+
+	// No window means no resize event, so create the offscreen frame buffer now
+	resize(mWidth, mHeight);
+	mFramePacer.setTargetFrameRate(mDesc.targetFrameRate);
 }
 
 Renderer::~Renderer()
@@ -42,8 +125,99 @@ void Renderer::initializeAPI(xwin::Window& window)
 #endif
 }
 
+void Renderer::initializeHeadlessAPI()
+{
+#if defined(XGFX_EGL)
+	mEGLDisplay = EGL_NO_DISPLAY;
+	mEGLContext = EGL_NO_CONTEXT;
+	mEGLSurface = EGL_NO_SURFACE;
+
+	// Prefer Mesa's surfaceless platform so we don't need a display server at all (llvmpipe on servers / CI)
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (eglGetPlatformDisplayEXT != nullptr)
+	{
+		display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if (display == EGL_NO_DISPLAY)
+	{
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+	{
+		std::cout << "Failed to initialize EGL.";
+		return;
+	}
+	mEGLDisplay = display;
+
+	// Without surfaceless contexts we fall back to a tiny pbuffer, all rendering goes to our frame buffer anyway
+	const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+	bool surfaceless = extensions != nullptr && strstr(extensions, "EGL_KHR_surfaceless_context") != nullptr;
+
+	const EGLint configAttribs[] =
+	{
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint configCount = 0;
+	eglBindAPI(EGL_OPENGL_API);
+	if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0)
+	{
+		std::cout << "Failed to find an EGL config.";
+		return;
+	}
+
+	const EGLint contextAttribs[] =
+	{
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	mEGLContext = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+
+	if (!surfaceless)
+	{
+		const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		mEGLSurface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+	}
+
+	if (mEGLContext == EGL_NO_CONTEXT || !eglMakeCurrent(display, mEGLSurface, mEGLSurface, mEGLContext))
+	{
+		std::cout << "Failed to create an EGL context.";
+		return;
+	}
+
+	if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+	{
+		// Failed
+		std::cout << "Failed to load OpenGL.";
+		return;
+	}
+#else
+	throw std::runtime_error("headless OpenGL requires EGL!");
+#endif
+}
+
 void Renderer::destroyAPI()
 {
+#if defined(XGFX_EGL)
+	if (mHeadless)
+	{
+		eglMakeCurrent(mEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (mEGLSurface != EGL_NO_SURFACE)
+		{
+			eglDestroySurface(mEGLDisplay, mEGLSurface);
+		}
+		eglDestroyContext(mEGLDisplay, mEGLContext);
+		eglTerminate(mEGLDisplay);
+		return;
+	}
+#endif
 	xgfx::unsetContext(mOGLState);
 	xgfx::destroyContext(mOGLState);
 }
@@ -54,10 +228,340 @@ void Renderer::initializeResources()
 	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 	glEnable(GL_DEPTH_TEST);
 
-	glGenVertexArrays(1, &mVertexArray);
-	glBindVertexArray(mVertexArray);
-	glEnableVertexAttribArray(0);
+	mProgram = createMainProgram();
+
+	createVertexArray();
+
+	if (mDesc.instanceCount > 0)
+	{
+		// One glDrawElementsInstanced, the instance attributes step once per instance and are pointed at the ring each frame
+		mBatch.multiDrawIndirect = false;
+		createInstancePlacements();
+		for (GLuint column = 0; column < 4; ++column)
+		{
+			glEnableVertexAttribArray(InstanceAttrib + column);
+			glVertexAttribDivisor(InstanceAttrib + column, 1);
+		}
+	}
+	else
+	{
+		// Every draw in one glMultiDrawElementsIndirect where the driver can, otherwise one draw call each
+		createBatch();
+	}
+	glUseProgram(mBatch.multiDrawIndirect ? mBatchProgram : mProgram);
+
+	// Uniform ring, render() writes every draw's transform into it every frame
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	if (mBatch.multiDrawIndirect)
+	{
+		GLint storageAlignment = 256;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+		alignment = std::max(alignment, storageAlignment);
+	}
+	mUniformRing.alignment = std::max<GLsizeiptr>(alignment, 1);
+	// The multi-draw reads a packed array of transforms, without it every draw binds its own aligned uboVS
+	GLsizeiptr uboSize = static_cast<GLsizeiptr>(sizeof(uboVS));
+	mBatch.transformStride = mBatch.multiDrawIndirect ? uboSize : ((uboSize + mUniformRing.alignment - 1) / mUniformRing.alignment) * mUniformRing.alignment;
+	// Room for when nothing is culled, with the multi-draw's commands after the transforms and alignment padding after each
+	GLsizeiptr drawCount = static_cast<GLsizeiptr>(mBatch.commands.size());
+	GLsizeiptr batchBytes = mBatch.transformStride * drawCount + mUniformRing.alignment;
+	if (mBatch.multiDrawIndirect)
+	{
+		batchBytes += static_cast<GLsizeiptr>(sizeof(DrawElementsIndirectCommand)) * drawCount + mUniformRing.alignment;
+	}
+	batchBytes += static_cast<GLsizeiptr>(sizeof(InstanceData)) * static_cast<GLsizeiptr>(mDesc.instanceCount);
+	GLsizeiptr uniformBytes = std::max(static_cast<GLsizeiptr>(mDesc.uniformBytesPerFrame), batchBytes);
+	mUniformRing.frameSize = ((uniformBytes + mUniformRing.alignment - 1) / mUniformRing.alignment) * mUniformRing.alignment;
+	mUniformRing.fences.assign(std::max(mDesc.framesInFlight, 1u) + 1, nullptr);
+	mUniformRing.region = 0;
+	mUniformRing.mapped = nullptr;
+
+	glGenBuffers(1, &mUniformRing.buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, mUniformRing.buffer);
+	GLsizeiptr ringSize = mUniformRing.frameSize * static_cast<GLsizeiptr>(mUniformRing.fences.size());
+	if (GLAD_GL_ARB_buffer_storage)
+	{
+		// Coherent, so writes become visible to the GPU without a flush
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, ringSize, nullptr, flags);
+		mUniformRing.mapped = static_cast<uint8_t*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, ringSize, flags));
+	}
+	else
+	{
+		glBufferData(GL_UNIFORM_BUFFER, mUniformRing.frameSize, nullptr, GL_STREAM_DRAW);
+	}
+	resetUniformRing();
 
+	// Update Uniforms
+	mProjectionMatrix = Matrix4::perspective(45.0f, (float)1280 / (float)720, 0.01f, 1024.0f);
+	mViewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, -2.5f)) * Matrix4::rotationZ(3.14f);
+	mModelMatrix = Matrix4::identity();
+
+	createQueries();
+
+	if (mDesc.shaderHotReload)
+	{
+		watchShaders({ "triangle", mDesc.instanceCount > 0 ? "triangle.instanced" : "triangle.batch" }, "glsl");
+	}
+}
+
+void Renderer::reloadShaders()
+{
+	std::vector<std::string> programs = mShaderWatcher.takeChangedPrograms();
+	if (programs.empty())
+	{
+		return;
+	}
+
+	ProfileScope scope(mProfiler, "Shader Reload");
+
+	bool mainRebuilt = false;
+	for (const std::string& name : programs)
+	{
+		// The batch program is only built when multi-draw indirect is in use
+		bool batch = name == "triangle.batch";
+		if (batch && !mBatch.multiDrawIndirect)
+		{
+			continue;
+		}
+
+		// The instanced program shares triangle.frag, so either program changing rebuilds it once
+		if (!batch && mainRebuilt)
+		{
+			continue;
+		}
+		mainRebuilt = mainRebuilt || !batch;
+
+		GLuint program = 0;
+		try
+		{
+			program = batch ? createProgram(name) : createMainProgram();
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "Failed to load " << name << " shaders: " << e.what() << "\n";
+		}
+		if (program == 0)
+		{
+			std::cout << "Failed to reload program " << name << ", keeping the running one\n";
+			continue;
+		}
+
+		// The driver keeps a deleted program alive until draws already submitted with it are done, so nothing waits here
+		GLuint& current = batch ? mBatchProgram : mProgram;
+		glDeleteProgram(current);
+		current = program;
+	}
+	glUseProgram(mBatch.multiDrawIndirect ? mBatchProgram : mProgram);
+}
+
+void Renderer::destroyResources()
+{
+	mShaderWatcher.stop();
+
+	glDeleteProgram(mProgram);
+	glDeleteProgram(mBatchProgram);
+	destroyBatch();
+	glDeleteVertexArrays(1, &mVertexArray);
+	glDeleteBuffers(1, &mVertexBuffer);
+	glDeleteBuffers(1, &mIndexBuffer);
+
+	for (GLsync& fence : mUniformRing.fences)
+	{
+		if (fence != nullptr)
+		{
+			glDeleteSync(fence);
+		}
+	}
+	if (mUniformRing.mapped != nullptr)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, mUniformRing.buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}
+	glDeleteBuffers(1, &mUniformRing.buffer);
+
+	destroyQueries();
+
+	for (ReadbackBuffer& readback : mReadbacks)
+	{
+		if (readback.fence != nullptr)
+		{
+			glDeleteSync(readback.fence);
+		}
+		glDeleteBuffers(1, &readback.buffer);
+	}
+	mReadbacks.clear();
+}
+
+void Renderer::render()
+{
+	mProfiler.nextFrame();
+
+	// Sleep until the frame pacer says the next frame is due, rather than spinning on the clock
+	float time;
+	{
+		ProfileScope scope(mProfiler, "Frame Pacing");
+		time = mFramePacer.waitForNextFrame();
+	}
+
+	if (!mHeadless)
+	{
+		ProfileScope scope(mProfiler, "Present");
+
+		FramePacer::Clock::time_point presentStart = FramePacer::Clock::now();
+		xgfx::swapBuffers(mOGLState);
+		mFramePacer.onPresent(presentStart);
+
+		// There's no portable way to ask GL when the frame reached the display, the swap returning is as close as it gets
+		if (mLatencyTag != 0)
+		{
+			mLatency.onPresented(mLatencyTag, LatencyTracker::Clock::now());
+			mLatencyTag = 0;
+		}
+	}
+
+	if (!mReadbacks.empty())
+	{
+		ProfileScope scope(mProfiler, "Readback");
+		deliverReadbacks();
+	}
+
+	// Swap in edited shaders before this frame's draws
+	reloadShaders();
+
+	// Only draws inside the view frustum go any further. The model matrix spins meshes about their origin,
+	// which leaves their bounding spheres where they are, so the scene only holds the placements
+	if (mDesc.instanceCount == 0)
+	{
+		ProfileScope scope(mProfiler, "Culling");
+		mBatch.visibleCount = mBatch.scene.cull(Frustum::fromMatrix(mProjectionMatrix * mViewMatrix), mBatch.visible.data());
+	}
+
+	// Update Uniforms
+	{
+		ProfileScope scope(mProfiler, "Uniform Update");
+
+		mElapsedTime += 0.001f * time;
+		mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
+
+		mModelMatrix = Matrix4::rotationY(mElapsedTime);
+
+		// This frame's state is sampled here, so it's the one that shows the input reported so far
+		if (mDesc.measureLatency && !mHeadless)
+		{
+			mLatencyTag = mLatency.tagFrame();
+		}
+
+		resetUniformRing();
+		if (mDesc.instanceCount > 0)
+		{
+			updateInstances();
+		}
+		else
+		{
+			updateTransforms();
+		}
+	}
+
+	// Draw, frame buffer 0 is the window's backbuffer
+	ProfileScope scope(mProfiler, "Submit");
+
+	readQueries();
+
+	// If the GPU is a whole ring of queries behind, this frame just goes untimed
+	GpuQueries* queries = nullptr;
+	if (mTimerQueries && !mQueries[mQueryIndex].pending)
+	{
+		queries = &mQueries[mQueryIndex];
+		queries->profilerFrame = mProfiler.getFrameIndex();
+		queries->pending = true;
+		queries->blit = false;
+		mQueryIndex = (mQueryIndex + 1) % mQueries.size();
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFrameBuffer);
+	glViewport(0, 0, mWidth, mHeight);
+
+	if (queries != nullptr)
+	{
+		glQueryCounter(queries->timestamps[0], GL_TIMESTAMP);
+		for (size_t i = 0; mStatisticsQueries && i < 6; ++i)
+		{
+			glBeginQuery(PipelineStatisticsTargets[i], queries->statistics[i]);
+		}
+	}
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (mDesc.instanceCount > 0)
+	{
+		const Mesh& mesh = mMeshes[0];
+		glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, reinterpret_cast<void*>(mesh.firstIndex * sizeof(uint32_t)),
+			static_cast<GLsizei>(mDesc.instanceCount));
+	}
+	else
+	{
+		drawBatch();
+	}
+
+	if (queries != nullptr)
+	{
+		for (size_t i = 0; mStatisticsQueries && i < 6; ++i)
+		{
+			glEndQuery(PipelineStatisticsTargets[i]);
+		}
+		glQueryCounter(queries->timestamps[1], GL_TIMESTAMP);
+	}
+	fenceUniformRing();
+
+	// Headless frames stay in the offscreen frame buffer, direct frames are already in the backbuffer
+	if (!mHeadless && mOffscreen)
+	{
+		// Post processing would go here, then blit framebuffer to window
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, mFrameBuffer);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glViewport(0, 0, mWidth, mHeight);
+		glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+		if (queries != nullptr)
+		{
+			glQueryCounter(queries->timestamps[2], GL_TIMESTAMP);
+			queries->blit = true;
+		}
+	}
+
+	copyReadback();
+}
+
+void Renderer::resize(unsigned width, unsigned height)
+{
+	mWidth = clamp(width, 1u, 0xffffu);
+	mHeight = clamp(height, 1u, 0xffffu);
+
+	// Update Unforms, render() pushes them with the next frame
+	mProjectionMatrix = Matrix4::perspective(45.0f, static_cast<float>(mWidth) / static_cast<float>(mHeight), 0.01f, 1024.0f);
+
+	destroyFrameBuffer();
+	initFrameBuffer();
+}
+
+GLuint Renderer::createMainProgram()
+{
+	bool instanced = mDesc.instanceCount > 0;
+	GLuint program = instanced ? createProgram("triangle.instanced", "triangle") : createProgram("triangle");
+
+	// The batch and instanced programs read their transforms from draw data or vertex attributes rather than a uniform block
+	if (program != 0 && !instanced)
+	{
+		GLuint matrixBlockIndex = glGetUniformBlockIndex(program, "UBO");
+		glUniformBlockBinding(program, matrixBlockIndex, 0);
+	}
+	return program;
+}
+
+GLuint Renderer::createProgram(const std::string& name, const std::string& fragmentName)
+{
 	auto checkShaderCompilation = [&](GLuint shader)
 	{
 #if defined(_DEBUG)
@@ -69,7 +573,6 @@ void Renderer::initializeResources()
 			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
 			std::vector<char> errorLog(maxLength);
 			glGetShaderInfoLog(shader, maxLength, &maxLength, &errorLog[0]);
-			glDeleteShader(shader);
 
 			std::cout << errorLog.data();
 
@@ -79,37 +582,199 @@ void Renderer::initializeResources()
 		return true;
 	};
 
-	std::vector<char> vertShaderCode = readFile("assets/shaders/triangle.vert.glsl");
+	std::vector<char> vertShaderCode = readShader("assets/shaders/" + name + ".vert.glsl");
 	GLchar* vertStr = vertShaderCode.data();
 	GLint vertLen = static_cast<GLint>(vertShaderCode.size());
-	std::vector<char> fragShaderCode = readFile("assets/shaders/triangle.frag.glsl");
+	std::vector<char> fragShaderCode = readShader("assets/shaders/" + (fragmentName.empty() ? name : fragmentName) + ".frag.glsl");
 	GLchar* fragStr = fragShaderCode.data();
 	GLint fragLen = static_cast<GLint>(fragShaderCode.size());
 
-	mVertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(mVertexShader, 1, &vertStr, &vertLen);
-	glCompileShader(mVertexShader);
-	if (!checkShaderCompilation(mVertexShader)) return;
+	// Try the program binary cache before compiling anything
+	uint64_t programKey = getProgramKey({ &vertShaderCode, &fragShaderCode });
+	GLuint program = glCreateProgram();
+
+	if (loadProgramBinary(program, name, programKey))
+	{
+		return program;
+	}
 
-	mFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(mFragmentShader, 1, &fragStr, &fragLen);
-	glCompileShader(mFragmentShader);
-	if (!checkShaderCompilation(mFragmentShader)) return;
+	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShader, 1, &vertStr, &vertLen);
+	glCompileShader(vertexShader);
 
-	mProgram = glCreateProgram();
-	glAttachShader(mProgram, mVertexShader);
-	glAttachShader(mProgram, mFragmentShader);
-	glLinkProgram(mProgram);
+	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragmentShader, 1, &fragStr, &fragLen);
+	glCompileShader(fragmentShader);
 
 	GLint result = 0;
-	glGetProgramiv(mProgram, GL_LINK_STATUS, &result);
+	if (checkShaderCompilation(vertexShader) && checkShaderCompilation(fragmentShader))
+	{
+		glAttachShader(program, vertexShader);
+		glAttachShader(program, fragmentShader);
+		if (GLAD_GL_ARB_get_program_binary)
+		{
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		glLinkProgram(program);
+		glGetProgramiv(program, GL_LINK_STATUS, &result);
+
+		// The program keeps what it linked, the shader objects aren't needed anymore
+		glDetachShader(program, vertexShader);
+		glDetachShader(program, fragmentShader);
+	}
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	if (result != GL_TRUE)
+	{
 #if defined(_DEBUG)
-	if (result != GL_TRUE) {
-		std::cout << "Program failed to link.";
+		std::cout << "Program " << name << " failed to link.";
+#endif
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	saveProgramBinary(program, name, programKey);
+	return program;
+}
+
+bool Renderer::loadProgramBinary(GLuint program, const std::string& name, uint64_t key)
+{
+	if (mDesc.pipelineCachePath.empty() || !GLAD_GL_ARB_get_program_binary)
+	{
+		return false;
+	}
+
+	std::vector<char> data;
+	try
+	{
+		data = readFile(mDesc.pipelineCachePath + "." + name);
+	}
+	catch (const std::runtime_error&)
+	{
+		// First launch, nothing cached yet
+		return false;
+	}
+
+	ProgramBinaryHeader header;
+	if (data.size() < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+
+	// A different source or driver changes the key, so stale binaries are never handed to the driver
+	if (header.magic != ProgramBinaryMagic || header.key != key || header.length != data.size() - sizeof(header))
+	{
+		return false;
+	}
+
+	glProgramBinary(program, header.format, data.data() + sizeof(header), static_cast<GLsizei>(header.length));
+
+	// Drivers may still reject a binary, in which case the program gets compiled as usual
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	return linked == GL_TRUE;
+}
+
+void Renderer::saveProgramBinary(GLuint program, const std::string& name, uint64_t key)
+{
+	if (mDesc.pipelineCachePath.empty() || !GLAD_GL_ARB_get_program_binary)
+	{
 		return;
 	}
-#endif
-	glUseProgram(mProgram);
+
+	// Some drivers support the extension but no binary formats
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+	{
+		return;
+	}
+
+	ProgramBinaryHeader header = {};
+	std::vector<char> data(sizeof(header) + length);
+	GLsizei written = 0;
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &written, &format, data.data() + sizeof(header));
+
+	header.magic = ProgramBinaryMagic;
+	header.format = format;
+	header.key = key;
+	header.length = static_cast<uint32_t>(written);
+	memcpy(data.data(), &header, sizeof(header));
+
+	try
+	{
+		writeFile(mDesc.pipelineCachePath + "." + name, data.data(), sizeof(header) + written);
+	}
+	catch (const std::runtime_error&)
+	{
+		// Read only working directory, we'll just compile again next launch
+	}
+}
+
+void Renderer::createVertexArray()
+{
+	// A quad alongside the triangle, so a scene of several draws mixes meshes
+	const Vertex quadVertices[4] =
+	{
+		{ { -1.0f, -1.0f, 0.0f },{ 1.0f, 0.0f, 0.0f } },
+		{ { 1.0f, -1.0f, 0.0f },{ 0.0f, 1.0f, 0.0f } },
+		{ { 1.0f, 1.0f, 0.0f },{ 0.0f, 0.0f, 1.0f } },
+		{ { -1.0f, 1.0f, 0.0f },{ 1.0f, 1.0f, 0.0f } }
+	};
+	const uint32_t quadIndices[6] = { 0, 1, 2, 2, 3, 0 };
+
+	// Meshes go back to back, draws pick theirs with firstIndex and baseVertex so nothing is rebound between them
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	auto addMesh = [&](const Vertex* meshVertices, size_t vertexCount, const uint32_t* meshIndices, size_t indexCount)
+	{
+		float radius = 0.0f;
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			const float* position = meshVertices[i].position;
+			radius = std::max(radius, std::sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]));
+		}
+		mMeshes.push_back(Mesh{ static_cast<GLuint>(indexCount), static_cast<GLuint>(indices.size()), static_cast<GLint>(vertices.size()), radius });
+		vertices.insert(vertices.end(), meshVertices, meshVertices + vertexCount);
+		indices.insert(indices.end(), meshIndices, meshIndices + indexCount);
+	};
+	mMeshes.clear();
+	addMesh(mVertexBufferData, 3, mIndexBufferData, 3);
+	addMesh(quadVertices, 4, quadIndices, 6);
+
+	GLsizeiptr vertexBytes = static_cast<GLsizeiptr>(sizeof(Vertex) * vertices.size());
+	GLsizeiptr indexBytes = static_cast<GLsizeiptr>(sizeof(uint32_t) * indices.size());
+
+	if (GLAD_GL_ARB_direct_state_access)
+	{
+		// Objects are edited by name, nothing gets bound until the draw needs it
+		glCreateBuffers(1, &mVertexBuffer);
+		glCreateBuffers(1, &mIndexBuffer);
+		glNamedBufferStorage(mVertexBuffer, vertexBytes, vertices.data(), 0);
+		glNamedBufferStorage(mIndexBuffer, indexBytes, indices.data(), 0);
+
+		glCreateVertexArrays(1, &mVertexArray);
+		glVertexArrayVertexBuffer(mVertexArray, 0, mVertexBuffer, 0, sizeof(Vertex));
+		glVertexArrayElementBuffer(mVertexArray, mIndexBuffer);
+
+		glEnableVertexArrayAttrib(mVertexArray, PositionAttrib);
+		glVertexArrayAttribFormat(mVertexArray, PositionAttrib, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
+		glVertexArrayAttribBinding(mVertexArray, PositionAttrib, 0);
+
+		glEnableVertexArrayAttrib(mVertexArray, ColorAttrib);
+		glVertexArrayAttribFormat(mVertexArray, ColorAttrib, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, color));
+		glVertexArrayAttribBinding(mVertexArray, ColorAttrib, 0);
+
+		glBindVertexArray(mVertexArray);
+		return;
+	}
+
+	// Bind to edit, the vertex array has to be bound first so it captures the index buffer and attributes
+	glGenVertexArrays(1, &mVertexArray);
+	glBindVertexArray(mVertexArray);
 
 	glGenBuffers(1, &mVertexBuffer);
 	glGenBuffers(1, &mIndexBuffer);
@@ -117,101 +782,420 @@ void Renderer::initializeResources()
 	glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer);
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * 3, mVertexBufferData, GL_STATIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * 3, mIndexBufferData, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices.data(), GL_STATIC_DRAW);
 
-	mPositionAttrib = glGetAttribLocation(mProgram, "inPos");
-	mColorAttrib = glGetAttribLocation(mProgram, "inColor");
-	glEnableVertexAttribArray(mPositionAttrib);
-	glEnableVertexAttribArray(mColorAttrib);
-	glVertexAttribPointer(mPositionAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-	glVertexAttribPointer(mColorAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+	glEnableVertexAttribArray(PositionAttrib);
+	glEnableVertexAttribArray(ColorAttrib);
+	glVertexAttribPointer(PositionAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+	glVertexAttribPointer(ColorAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+}
 
-	GLuint matrixBlockIndex = glGetUniformBlockIndex(mProgram, "UBO");
-	glUniformBlockBinding(mProgram, matrixBlockIndex, 0);
+void Renderer::createBatch()
+{
+	// Square grid of draws, a single draw keeps the triangle where it's always been
+	unsigned drawCount = std::max(mDesc.drawCount, 1u);
 
-	glGenBuffers(1, &mUniformUBO);
-	glBindBuffer(GL_UNIFORM_BUFFER, mUniformUBO);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(uboVS), &uboVS, GL_DYNAMIC_DRAW);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, mUniformUBO, 0, sizeof(uboVS));
-	// Update Uniforms
-	uboVS.projectionMatrix = Matrix4::perspective(45.0f, (float)1280 / (float)720, 0.01f, 1024.0f);
-	uboVS.viewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, -2.5f)) * Matrix4::rotationZ(3.14f);
-	uboVS.modelMatrix = Matrix4::identity();
+	mBatch.commands.clear();
+	mBatch.scene.resize(drawCount);
+	for (unsigned draw = 0; draw < drawCount; ++draw)
+	{
+		const Mesh& mesh = mMeshes[draw % mMeshes.size()];
+		mBatch.commands.push_back(DrawElementsIndirectCommand{ mesh.indexCount, 1, mesh.firstIndex, mesh.baseVertex, 0 });
 
-	GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-	memcpy(p, &uboVS, sizeof(uboVS));
-	glUnmapBuffer(GL_UNIFORM_BUFFER);
+		mBatch.scene.setObject(draw, getGridPlacement(draw, drawCount), Vector3(0.0f, 0.0f, 0.0f), mesh.radius);
+	}
+	mBatch.visible.assign(mBatch.scene.capacity(), 0);
+	mBatch.visibleCount = 0;
+	mBatch.transformOffset = 0;
+	mBatch.commandOffset = 0;
 
+	// Multi-draw indirect and storage buffers are GL 4.3, gl_DrawIDARB needs GL_ARB_shader_draw_parameters
+	mBatch.multiDrawIndirect = GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_shader_storage_buffer_object && GLAD_GL_ARB_shader_draw_parameters;
+	if (mBatch.multiDrawIndirect)
+	{
+		mBatchProgram = createProgram("triangle.batch");
+		mBatch.multiDrawIndirect = mBatchProgram != 0;
+	}
 }
 
-void Renderer::destroyResources()
+void Renderer::destroyBatch()
 {
-	glDisableVertexAttribArray(mPositionAttrib);
-	glDisableVertexAttribArray(mColorAttrib);
-	glDeleteShader(mVertexShader);
-	glDeleteShader(mFragmentShader);
-	glDeleteProgram(mProgram);
-	glDeleteVertexArrays(1, &mVertexArray);
-	glDeleteBuffers(1, &mVertexBuffer);
-	glDeleteBuffers(1, &mIndexBuffer);
-	glDeleteBuffers(1, &mUniformUBO);
+	mBatch.commands.clear();
+	mBatch.visible.clear();
+	mBatch.visibleCount = 0;
 }
 
-void Renderer::render()
+void Renderer::updateTransforms()
+{
+	GLsizeiptr transformSize = mBatch.transformStride * static_cast<GLsizeiptr>(mBatch.visibleCount);
+	GLsizeiptr commandSize = mBatch.multiDrawIndirect ? static_cast<GLsizeiptr>(sizeof(DrawElementsIndirectCommand) * mBatch.visibleCount) : 0;
+	mBatch.transformOffset = allocateUniforms(static_cast<size_t>(transformSize));
+	mBatch.commandOffset = allocateUniforms(static_cast<size_t>(commandSize));
+
+	// Straight into the ring when it's persistently mapped, otherwise staged like the ring region and uploaded after
+	uint8_t* region;
+	GLintptr regionOffset = mBatch.transformOffset;
+	if (mUniformRing.mapped != nullptr)
+	{
+		region = mUniformRing.mapped + regionOffset;
+	}
+	else
+	{
+		mBatch.staging.resize(static_cast<size_t>(mBatch.commandOffset + commandSize - regionOffset));
+		region = mBatch.staging.data();
+	}
+
+	// One model view projection matrix per visible draw, a SIMD batch of draws at a time
+	concatenateTransforms(mProjectionMatrix * mViewMatrix, mBatch.scene.getTransforms(), mBatch.visible.data(), mBatch.visibleCount,
+		mModelMatrix, region, static_cast<size_t>(mBatch.transformStride));
+
+	if (mBatch.multiDrawIndirect)
+	{
+		// gl_DrawIDARB counts visible draws, so command i lines up with transform i
+		DrawElementsIndirectCommand* commands = reinterpret_cast<DrawElementsIndirectCommand*>(region + (mBatch.commandOffset - regionOffset));
+		for (size_t i = 0; i < mBatch.visibleCount; ++i)
+		{
+			commands[i] = mBatch.commands[mBatch.visible[i]];
+		}
+	}
+
+	if (mUniformRing.mapped == nullptr)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, mUniformRing.buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, regionOffset, static_cast<GLsizeiptr>(mBatch.staging.size()), region);
+	}
+
+	if (mBatch.multiDrawIndirect && mBatch.visibleCount > 0)
+	{
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, mUniformRing.buffer, mBatch.transformOffset, transformSize);
+	}
+}
+
+void Renderer::updateInstances()
 {
-	// Framelimit set to 60 fps
-	tEnd = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::milli>(tEnd - tStart).count();
-	if (time < (1000.0f / 60.0f))
+	GLsizeiptr size = static_cast<GLsizeiptr>(sizeof(InstanceData) * mDesc.instanceCount);
+	GLintptr offset = allocateUniforms(static_cast<size_t>(size));
+
+	// Same as updateTransforms, straight into the ring when it's persistently mapped, otherwise staged and uploaded in one call
+	if (mUniformRing.mapped != nullptr)
 	{
+		writeInstances(mUniformRing.mapped + offset);
+	}
+	else
+	{
+		mInstanceStaging.resize(static_cast<size_t>(size));
+		writeInstances(mInstanceStaging.data());
+		glBindBuffer(GL_UNIFORM_BUFFER, mUniformRing.buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, mInstanceStaging.data());
+	}
+
+	// Attribute pointers capture the buffer bound to GL_ARRAY_BUFFER, the vertex array stays bound
+	glBindBuffer(GL_ARRAY_BUFFER, mUniformRing.buffer);
+	for (GLuint column = 0; column < 4; ++column)
+	{
+		glVertexAttribPointer(InstanceAttrib + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			reinterpret_cast<void*>(offset + column * 4 * sizeof(float)));
+	}
+}
+
+void Renderer::drawBatch()
+{
+	if (mBatch.multiDrawIndirect)
+	{
+		// The driver sees one call however many draws are visible, reading the commands written into the ring this frame
+		if (mBatch.visibleCount > 0)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mUniformRing.buffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(mBatch.commandOffset),
+				static_cast<GLsizei>(mBatch.visibleCount), 0);
+		}
 		return;
 	}
-	tStart = std::chrono::high_resolution_clock::now();
 
-	xgfx::swapBuffers(mOGLState);
+	for (size_t i = 0; i < mBatch.visibleCount; ++i)
+	{
+		const DrawElementsIndirectCommand& command = mBatch.commands[mBatch.visible[i]];
+		GLintptr offset = mBatch.transformOffset + mBatch.transformStride * static_cast<GLintptr>(i);
+		glBindBufferRange(GL_UNIFORM_BUFFER, 0, mUniformRing.buffer, offset, sizeof(uboVS));
+		glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, reinterpret_cast<void*>(command.firstIndex * sizeof(uint32_t)), command.baseVertex);
+	}
+}
 
-	// Update Uniforms
-	mElapsedTime += 0.001f * time;
-	mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
+void Renderer::resetUniformRing()
+{
+	if (mUniformRing.mapped == nullptr)
+	{
+		// Orphan the old storage, the driver keeps it alive for draws still reading it
+		glBindBuffer(GL_UNIFORM_BUFFER, mUniformRing.buffer);
+		glBufferData(GL_UNIFORM_BUFFER, mUniformRing.frameSize, nullptr, GL_STREAM_DRAW);
+		mUniformRing.head = 0;
+		mUniformRing.end = mUniformRing.frameSize;
+		return;
+	}
 
-	uboVS.modelMatrix = Matrix4::rotationY(mElapsedTime);
-	GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-	memcpy(p, &uboVS, sizeof(uboVS));
-	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	mUniformRing.region = (mUniformRing.region + 1) % mUniformRing.fences.size();
 
-	// Draw
-	glBindFramebuffer(GL_FRAMEBUFFER, mFrameBuffer);
-	glViewport(0, 0, mWidth, mHeight);
+	// Only blocks when the CPU is a whole ring ahead of the GPU
+	GLsync& fence = mUniformRing.fences[mUniformRing.region];
+	if (fence != nullptr)
+	{
+		GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (status == GL_TIMEOUT_EXPIRED)
+		{
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
+	mUniformRing.head = mUniformRing.frameSize * static_cast<GLsizeiptr>(mUniformRing.region);
+	mUniformRing.end = mUniformRing.head + mUniformRing.frameSize;
+}
+
+GLintptr Renderer::allocateUniforms(size_t size)
+{
+	GLsizeiptr offset = mUniformRing.head;
+	GLsizeiptr alignedSize = ((static_cast<GLsizeiptr>(size) + mUniformRing.alignment - 1) / mUniformRing.alignment) * mUniformRing.alignment;
+	if (offset + alignedSize > mUniformRing.end)
+	{
+		throw std::runtime_error("uniform ring buffer is full!");
+	}
+
+	mUniformRing.head += alignedSize;
+	return offset;
+}
+
+GLintptr Renderer::pushUniforms(const void* data, size_t size)
+{
+	GLintptr offset = allocateUniforms(size);
+	if (mUniformRing.mapped != nullptr)
+	{
+		memcpy(mUniformRing.mapped + offset, data, size);
+	}
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, mUniformRing.buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	}
+	return offset;
+}
+
+void Renderer::fenceUniformRing()
+{
+	if (mUniformRing.mapped != nullptr)
+	{
+		mUniformRing.fences[mUniformRing.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+void Renderer::createQueries()
+{
+	// Timestamp queries are core since 3.3, Mesa's llvmpipe has them too so CI can track GPU time
+	mTimerQueries = GLAD_GL_VERSION_3_3 != 0;
+	mStatisticsQueries = mTimerQueries && mDesc.pipelineStatistics && GLAD_GL_ARB_pipeline_statistics_query;
+	if (!mTimerQueries)
+	{
+		return;
+	}
+
+	// Results come back a couple of frames late, one extra slot so a full ring doesn't stall
+	mQueries.resize(std::max(mDesc.framesInFlight, 1u) + 2);
+	for (GpuQueries& queries : mQueries)
+	{
+		glGenQueries(3, queries.timestamps);
+		if (mStatisticsQueries)
+		{
+			glGenQueries(6, queries.statistics);
+		}
+		queries.profilerFrame = 0;
+		queries.pending = false;
+		queries.blit = false;
+	}
+	mQueryIndex = 0;
+}
+
+void Renderer::destroyQueries()
+{
+	for (GpuQueries& queries : mQueries)
+	{
+		glDeleteQueries(3, queries.timestamps);
+		if (mStatisticsQueries)
+		{
+			glDeleteQueries(6, queries.statistics);
+		}
+	}
+	mQueries.clear();
+}
+
+void Renderer::readQueries()
+{
+	// The slot about to be reused is the oldest
+	for (size_t i = 0; i < mQueries.size(); ++i)
+	{
+		GpuQueries& queries = mQueries[(mQueryIndex + i) % mQueries.size()];
+		if (!queries.pending)
+		{
+			continue;
+		}
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(queries.timestamps[queries.blit ? 2 : 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_TRUE && mStatisticsQueries)
+		{
+			glGetQueryObjectuiv(queries.statistics[5], GL_QUERY_RESULT_AVAILABLE, &available);
+		}
+		if (available != GL_TRUE)
+		{
+			return;
+		}
+		queries.pending = false;
+
+		// Timestamps are in nanoseconds
+		GLuint64 timestamps[3] = { 0, 0, 0 };
+		for (size_t t = 0; t < (queries.blit ? 3u : 2u); ++t)
+		{
+			glGetQueryObjectui64v(queries.timestamps[t], GL_QUERY_RESULT, &timestamps[t]);
+		}
+
+		// The GPU clock isn't calibrated against the CPU one, so the pass is placed at the start of the frame that submitted it
+		unsigned framesAgo = static_cast<unsigned>(mProfiler.getFrameIndex() - queries.profilerFrame);
+		float renderPass = static_cast<float>(static_cast<double>(timestamps[1] - timestamps[0]) * 1e-6);
+		mProfiler.addGpuTime("Render Pass", 0.0f, renderPass, framesAgo);
+		if (queries.blit)
+		{
+			float blit = static_cast<float>(static_cast<double>(timestamps[2] - timestamps[1]) * 1e-6);
+			mProfiler.addGpuTime("Blit", renderPass, blit, framesAgo);
+		}
+
+		if (mStatisticsQueries)
+		{
+			GLuint64 counters[6];
+			for (size_t c = 0; c < 6; ++c)
+			{
+				glGetQueryObjectui64v(queries.statistics[c], GL_QUERY_RESULT, &counters[c]);
+			}
+			mPipelineStatistics.verticesSubmitted = counters[0];
+			mPipelineStatistics.primitivesSubmitted = counters[1];
+			mPipelineStatistics.vertexShaderInvocations = counters[2];
+			mPipelineStatistics.clippingInputPrimitives = counters[3];
+			mPipelineStatistics.clippingOutputPrimitives = counters[4];
+			mPipelineStatistics.fragmentShaderInvocations = counters[5];
+			mHasPipelineStatistics = true;
+		}
+	}
+}
+
+bool Renderer::getPipelineStatistics(PipelineStatistics& statistics) const
+{
+	if (mHasPipelineStatistics)
+	{
+		statistics = mPipelineStatistics;
+	}
+	return mHasPipelineStatistics;
+}
+
+void Renderer::setReadbackCallback(const ReadbackCallback& callback)
+{
+	mReadbackCallback = callback;
+}
+
+void Renderer::copyReadback()
+{
+	if (!mReadbackCallback)
+	{
+		return;
+	}
+
+	// Enough buffers to cover the frames the GPU may lag behind, plus the one being written
+	if (mReadbacks.empty())
+	{
+		mReadbacks.resize(std::max(mDesc.framesInFlight, 1u) + 2, ReadbackBuffer{ 0, nullptr, 0, ReadbackImage() });
+		mReadbackIndex = 0;
+	}
+
+	// Still waiting on the GPU, drop this frame rather than stall
+	ReadbackBuffer& readback = mReadbacks[mReadbackIndex];
+	if (readback.fence != nullptr)
+	{
+		return;
+	}
+
+	GLsizeiptr size = static_cast<GLsizeiptr>(mWidth) * static_cast<GLsizeiptr>(mHeight) * 4;
+	if (readback.buffer == 0)
+	{
+		glGenBuffers(1, &readback.buffer);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	if (readback.size != size)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+		readback.size = size;
+	}
 
-	// Blit framebuffer to window
+	// With a pack buffer bound glReadPixels only queues the copy, frame buffer 0 is the backbuffer about to be presented
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, mFrameBuffer);
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glViewport(0, 0, mWidth, mHeight);
-	glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glReadBuffer(mFrameBuffer != 0 ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	readback.image.frame = mProfiler.getFrameIndex();
+	readback.image.width = mWidth;
+	readback.image.height = mHeight;
+	readback.image.rowPitch = static_cast<size_t>(mWidth) * 4;
+	readback.image.bgra = false;
+	readback.image.bottomUp = true;
+
+	mReadbackIndex = (mReadbackIndex + 1) % mReadbacks.size();
 }
 
-void Renderer::resize(unsigned width, unsigned height)
+void Renderer::deliverReadbacks()
 {
-	mWidth = clamp(width, 1u, 0xffffu);
-	mHeight = clamp(height, 1u, 0xffffu);
+	// The slot about to be reused is the oldest
+	for (size_t i = 0; i < mReadbacks.size(); ++i)
+	{
+		ReadbackBuffer& readback = mReadbacks[(mReadbackIndex + i) % mReadbacks.size()];
+		if (readback.fence == nullptr)
+		{
+			continue;
+		}
 
-	// Update Unforms
-	uboVS.projectionMatrix = Matrix4::perspective(45.0f, static_cast<float>(mWidth) / static_cast<float>(mHeight), 0.01f, 1024.0f);
-	GLvoid* p = glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-	memcpy(p, &uboVS, sizeof(uboVS));
-	glUnmapBuffer(GL_UNIFORM_BUFFER);
+		// A zero timeout only polls, the flush makes sure the fence gets to the GPU even without a swap
+		GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			return;
+		}
+		glDeleteSync(readback.fence);
+		readback.fence = nullptr;
 
-	destroyFrameBuffer();
-	initFrameBuffer();
+		if (!mReadbackCallback || status == GL_WAIT_FAILED)
+		{
+			continue;
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		const uint8_t* pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.size, GL_MAP_READ_BIT));
+		if (pixels != nullptr)
+		{
+			readback.image.pixels = pixels;
+			mReadbackCallback(readback.image);
+			readback.image.pixels = nullptr;
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
 }
 
 void Renderer::initFrameBuffer()
 {
+	if (!mOffscreen)
+	{
+		return;
+	}
+
 	glGenTextures(1, &mFrameBufferTex);
 	glBindTexture(GL_TEXTURE_2D, mFrameBufferTex);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -248,6 +1232,9 @@ void Renderer::destroyFrameBuffer()
 	glDeleteTextures(1, &mFrameBufferTex);
 	glDeleteRenderbuffers(1, &mRenderBufferDepth);
 	glDeleteFramebuffers(1, &mFrameBuffer);
+	mFrameBufferTex = 0;
+	mRenderBufferDepth = 0;
+	mFrameBuffer = 0;
 }
 
 /**
@@ -3,12 +3,34 @@
 #include "CrossWindow/CrossWindow.h"
 #include "CrossWindow/Graphics.h"
 #include "vectormath.hpp"
+#include "FramePacer.h"
+#include "FrameProfiler.h"
+#include "LatencyTracker.h"
+
+#if defined(XGFX_VULKAN) || defined(XGFX_OPENGL)
+#include "ShaderWatcher.h"
+#include "Transforms.h"
+#endif
+
+#if defined(XGFX_VULKAN)
+#include "ThreadPool.h"
+#endif
+
+#if defined(XGFX_OPENGL)
+#include "Scene.h"
+#endif
+
+#if defined(XGFX_EMBED_SHADERS)
+#include "EmbeddedShaders.h"
+#endif
 
 #include <vector>
 #include <chrono>
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <functional>
+#include <cstdlib>
 
 #if defined(XWIN_WIN32)
 #include <direct.h>
@@ -18,7 +40,7 @@
 
 // Common Utils
 
-inline std::vector<char> readFile(const std::string& filename) {
+inline std::string getWorkingPath(const std::string& filename) {
 	std::string path = filename;
 	char pBuf[1024];
 #ifdef XWIN_WIN32
@@ -32,6 +54,10 @@ inline std::vector<char> readFile(const std::string& filename) {
 	path += "/";
 #endif
 	path += filename;
+	return path;
+}
+
+inline std::vector<char> readPath(const std::string& path) {
 	std::ifstream file(path, std::ios::ate | std::ios::binary);
 	bool exists = (bool)file;
 
@@ -50,6 +76,51 @@ inline std::vector<char> readFile(const std::string& filename) {
 	return buffer;
 };
 
+inline std::vector<char> readFile(const std::string& filename) {
+	return readPath(getWorkingPath(filename));
+}
+
+// Folder shaders are loaded from instead of the embedded / working directory copies, empty for none.
+// Starts out as the XGFX_SHADER_DIR environment variable, shader hot reload points it at the folder it watches.
+inline std::string& shaderDirectory() {
+	static std::string directory = getenv("XGFX_SHADER_DIR") != nullptr ? getenv("XGFX_SHADER_DIR") : "";
+	return directory;
+}
+
+// Compiled shaders are linked into the executable when built with XGFX_EMBED_SHADERS, so loading them does no I/O
+// and doesn't depend on the working directory. Setting the XGFX_SHADER_DIR environment variable loads them from
+// that folder instead, for iterating on shaders without a rebuild. Otherwise they're read relative to the working directory.
+inline std::vector<char> readShader(const std::string& filename) {
+	std::string name = filename.substr(filename.find_last_of("/\\") + 1);
+
+	if (!shaderDirectory().empty()) {
+		return readPath(shaderDirectory() + "/" + name);
+	}
+
+#if defined(XGFX_EMBED_SHADERS)
+	for (size_t i = 0; i < EmbeddedShaderCount; ++i) {
+		if (name == EmbeddedShaders[i].name) {
+			const char* data = reinterpret_cast<const char*>(EmbeddedShaders[i].data);
+			return std::vector<char>(data, data + EmbeddedShaders[i].size);
+		}
+	}
+#endif
+
+	return readFile(filename);
+}
+
+inline void writeFile(const std::string& filename, const void* data, size_t size) {
+	std::string path = getWorkingPath(filename);
+	std::ofstream file(path, std::ios::trunc | std::ios::binary);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to write file!");
+	}
+
+	file.write(static_cast<const char*>(data), size);
+	file.close();
+}
+
 template <typename T>
 inline T clamp(const T& value, const T& low, const T& high)
 {
@@ -57,12 +128,178 @@ inline T clamp(const T& value, const T& low, const T& high)
 }
 
 
+#if defined(XGFX_VULKAN)
+
+// Vulkan Device Memory
+
+// A sub-range of a device memory block handed out by DeviceMemoryAllocator
+struct DeviceAllocation
+{
+	vk::DeviceMemory memory;
+	vk::DeviceSize offset = 0;
+	vk::DeviceSize size = 0;
+	uint32_t block = ~0U;
+
+	// Persistently mapped pointer to this allocation, only set for host visible memory
+	uint8_t* mapped = nullptr;
+};
+
+struct DeviceMemoryStats
+{
+	uint32_t blockCount = 0;
+	uint32_t allocationCount = 0;
+	vk::DeviceSize blockBytes = 0;
+	vk::DeviceSize usedBytes = 0;
+};
+
+// Groups resources into large vk::DeviceMemory blocks per memory type instead of one vkAllocateMemory each
+class DeviceMemoryAllocator
+{
+public:
+	void create(vk::PhysicalDevice& physicalDevice, vk::Device& device, vk::DeviceSize blockSize);
+
+	void destroy();
+
+	// Images with optimal tiling live in their own blocks so we never have to respect bufferImageGranularity
+	DeviceAllocation allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, bool optimalImage = false);
+
+	void free(DeviceAllocation& allocation);
+
+	DeviceMemoryStats getStats() const;
+
+protected:
+	struct Range
+	{
+		vk::DeviceSize offset;
+		vk::DeviceSize size;
+	};
+
+	struct Block
+	{
+		vk::DeviceMemory memory;
+		vk::DeviceSize size;
+		uint32_t memoryType;
+		bool optimalImage;
+		uint8_t* mapped;
+		uint32_t allocationCount;
+
+		// Sorted by offset, adjacent ranges are always merged
+		std::vector<Range> freeRanges;
+	};
+
+	bool allocateFromBlock(Block& block, vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& outOffset);
+
+	// Unmap and free a block's memory, leaving an empty slot in mBlocks
+	void releaseBlock(Block& block);
+
+	vk::Device mDevice;
+	vk::PhysicalDeviceMemoryProperties mMemoryProperties;
+	vk::DeviceSize mBlockSize;
+	std::vector<Block> mBlocks;
+};
+
+#endif
+
+// Renderer Description
+
+// Swapchain present modes, FIFO waits for vertical blank, mailbox replaces the queued image, immediate may tear
+enum class PresentMode
+{
+	Immediate,
+	Mailbox,
+	Fifo
+};
+
+struct RendererDesc
+{
+	// Number of frames the CPU may record ahead of the GPU (Vulkan, OpenGL uniform ring)
+	unsigned framesInFlight = 2;
+
+	// Bytes of uniform data each frame may push into the uniform ring buffer (Vulkan, OpenGL)
+	size_t uniformBytesPerFrame = 64 * 1024;
+
+	// Frames per second the frame pacer targets, 0 renders uncapped for benchmarking
+	float targetFrameRate = 60.0f;
+
+	// Size of the offscreen images when rendering headless
+	unsigned width = 1280;
+	unsigned height = 720;
+
+	// Where compiled pipelines are saved between launches, relative to the working directory, empty to disable.
+	// Vulkan writes its pipeline cache here, OpenGL writes one program binary per program to <path>.<program name>
+	std::string pipelineCachePath = "pipeline.cache";
+
+	// Draw into an offscreen frame buffer and blit it to the window, for post processing.
+	// Otherwise draws go straight to the backbuffer, headless always renders offscreen (OpenGL)
+	bool offscreenFrameBuffer = false;
+
+	// Threads recording draws into secondary command buffers, 1 records everything inline on the main thread (Vulkan)
+	unsigned recordingThreads = 1;
+
+	// Objects in the scene, laid out on a grid. OpenGL cycles through the meshes, Vulkan draws triangles with a draw call
+	// each, which the recording threads split between them (Vulkan, OpenGL)
+	unsigned drawCount = 1;
+
+	// Draw this many triangles on a grid with one instanced draw instead of the scene. Each instance's model view projection
+	// matrix is written into a per-instance vertex stream in the uniform ring every frame (Vulkan, OpenGL)
+	unsigned instanceCount = 0;
+
+	// Count vertices, primitives and shader invocations with GL_ARB_pipeline_statistics_query where supported (OpenGL)
+	bool pipelineStatistics = false;
+
+	// Watch the shader folder (XGFX_SHADER_DIR, or assets/shaders/ in the working directory) while running. Saved sources
+	// are recompiled in the background and changed programs swapped in between frames (Vulkan, OpenGL)
+	bool shaderHotReload = false;
+
+	// Tag frames with the input reported to the latency tracker, and time them until their present returns and,
+	// where the swapchain reports it with VK_GOOGLE_display_timing, until they're displayed (Vulkan, OpenGL)
+	bool measureLatency = false;
+
+	// Present mode to ask the swapchain for, unsupported modes fall back to mailbox where available, otherwise immediate (Vulkan)
+	PresentMode presentMode = PresentMode::Mailbox;
+};
+
+// Pipeline counters for the main pass of one frame
+struct PipelineStatistics
+{
+	uint64_t verticesSubmitted = 0;
+	uint64_t primitivesSubmitted = 0;
+	uint64_t vertexShaderInvocations = 0;
+	uint64_t clippingInputPrimitives = 0;
+	uint64_t clippingOutputPrimitives = 0;
+	uint64_t fragmentShaderInvocations = 0;
+};
+
+// A rendered frame copied back to the CPU, pixels are only valid during the readback callback
+struct ReadbackImage
+{
+	// Profiler frame index of the frame that rendered these pixels
+	uint64_t frame = 0;
+
+	unsigned width = 0;
+	unsigned height = 0;
+	size_t rowPitch = 0;
+
+	// 8 bits per channel, RGBA or BGRA (Vulkan swapchains are usually B8G8R8A8)
+	bool bgra = false;
+
+	// OpenGL rows start at the bottom of the image
+	bool bottomUp = false;
+
+	const uint8_t* pixels = nullptr;
+};
+
+typedef std::function<void(const ReadbackImage&)> ReadbackCallback;
+
 // Renderer
 
 class Renderer
 {
 public:
-	Renderer(xwin::Window& window);
+	Renderer(xwin::Window& window, const RendererDesc& desc = RendererDesc());
+
+	// Render into offscreen images with no window, surface or display (Vulkan / OpenGL)
+	Renderer(const RendererDesc& desc);
 
 	~Renderer();
 
@@ -72,11 +309,34 @@ public:
 	// Resize the window and internal data structures
 	void resize(unsigned width, unsigned height);
 
+	// Per-phase frame timings, the app can add its own scopes (such as the event pump)
+	FrameProfiler& getProfiler() { return mProfiler; }
+
+	// Input to photon latency, the app reports input as it pumps events and the renderer times the frames that show it
+	LatencyTracker& getLatencyTracker() { return mLatency; }
+
+	// Copy every frame back to the CPU and hand it to the callback a few frames later, once the GPU has finished it.
+	// Never waits on the GPU, frames are skipped instead if the readback ring is full. An empty callback stops readback (Vulkan / OpenGL)
+	void setReadbackCallback(const ReadbackCallback& callback);
+
+#if defined(XGFX_VULKAN)
+	// How full the device memory blocks are, to tune the allocator's block size
+	DeviceMemoryStats getDeviceMemoryStats() const { return mAllocator.getStats(); }
+#endif
+
+#if defined(XGFX_OPENGL)
+	// Counters of the most recent frame the GPU finished, false if none were read back (or they're turned off)
+	bool getPipelineStatistics(PipelineStatistics& statistics) const;
+#endif
+
 protected:
 
 	// Initialize your Graphics API
 	void initializeAPI(xwin::Window& window);
 
+	// Initialize your Graphics API without a window to present to
+	void initializeHeadlessAPI();
+
 	// Destroy any Graphics API data structures used in this example
 	void destroyAPI();
 
@@ -98,6 +358,7 @@ protected:
 	// Set up the FrameBuffer
 	void initFrameBuffer();
 
+	// Destroy the FrameBuffer along with everything sized to the surface, the GPU must be idle
 	void destroyFrameBuffer();
 
 	// Set up the RenderPass
@@ -123,16 +384,77 @@ protected:
 
 	uint32_t mIndexBufferData[3] = { 0, 1, 2 };
 
-	std::chrono::time_point<std::chrono::steady_clock> tStart, tEnd;
+	RendererDesc mDesc;
+	bool mHeadless = false;
+	ReadbackCallback mReadbackCallback;
+
+	FramePacer mFramePacer;
+	LatencyTracker mLatency;
+	FrameProfiler mProfiler;
 	float mElapsedTime = 0.0f;
 
+	// Camera and object transforms, concatenated on the CPU so shaders do one matrix multiply per vertex
+	Matrix4 mProjectionMatrix;
+	Matrix4 mViewMatrix;
+	Matrix4 mModelMatrix;
+
 	// Uniform data
 	struct {
-		Matrix4 projectionMatrix;
-		Matrix4 modelMatrix;
-		Matrix4 viewMatrix;
+		Matrix4 modelViewProjection;
 	} uboVS;
 
+#if defined(XGFX_VULKAN) || defined(XGFX_OPENGL)
+	// Shader hot reload, the render thread picks up the programs it rebuilt at the start of a frame
+	ShaderWatcher mShaderWatcher;
+
+	// Load shaders from the watched folder from now on, so the embedded copies don't shadow edits, and start watching it
+	void watchShaders(const std::vector<std::string>& programs, const std::string& compiledExtension)
+	{
+		if (shaderDirectory().empty())
+		{
+			shaderDirectory() = getWorkingPath("assets/shaders");
+		}
+		mShaderWatcher.start(shaderDirectory(), programs, compiledExtension);
+	}
+
+	// Swap in programs whose shaders changed since the last frame, keeping the old ones if they fail to build (Vulkan, OpenGL)
+	void reloadShaders();
+
+	// Per-instance vertex data, the matrix is read as four column attributes at locations 2 to 5 (assets/shaders/triangle.instanced.vert)
+	struct InstanceData
+	{
+		float modelViewProjection[16];
+	};
+
+	// Where object index of count goes on a square grid filling the view, a single object keeps the triangle where it's always been
+	static Matrix4 getGridPlacement(unsigned index, unsigned count)
+	{
+		unsigned columns = static_cast<unsigned>(std::ceil(std::sqrt(static_cast<float>(count))));
+		float cellScale = 1.0f / static_cast<float>(columns);
+		float x = (2.0f * static_cast<float>(index % columns) + 1.0f) * cellScale - 1.0f;
+		float y = (2.0f * static_cast<float>(index / columns) + 1.0f) * cellScale - 1.0f;
+		return Matrix4::translation(Vector3(x, y, 0.0f)) * Matrix4::scale(Vector3(cellScale, cellScale, cellScale));
+	}
+
+	// Placements of the instances when drawing instanced, concatenated with the camera and model matrices every frame
+	MatrixArray mInstancePlacements;
+
+	void createInstancePlacements()
+	{
+		mInstancePlacements.resize(mDesc.instanceCount);
+		for (unsigned instance = 0; instance < mDesc.instanceCount; ++instance)
+		{
+			mInstancePlacements.set(instance, getGridPlacement(instance, mDesc.instanceCount));
+		}
+	}
+
+	// Write every instance's InstanceData to output, a SIMD batch of instances at a time
+	void writeInstances(void* output)
+	{
+		concatenateTransforms(mProjectionMatrix * mViewMatrix, mInstancePlacements, mModelMatrix, output, sizeof(InstanceData));
+	}
+#endif
+
 #if defined(XGFX_VULKAN)
 	// Initialization
 	vk::Instance mInstance;
@@ -147,9 +469,31 @@ protected:
 	uint32_t mQueueFamilyIndex;
 
 	vk::CommandPool mCommandPool;
+	// One command buffer per frame in flight per swapchain image, indexed [frame * imageCount + image]
 	std::vector<vk::CommandBuffer> mCommandBuffers;
 	uint32_t mCurrentBuffer;
 
+	// Parallel recording, each job owns a command pool and a secondary command buffer per primary, indexed [job][primary]
+	ThreadPool mRecordingThreads;
+	std::vector<vk::CommandPool> mJobCommandPools;
+	std::vector<std::vector<vk::CommandBuffer>> mSecondaryCommandBuffers;
+
+	// Draws in the scene, split into contiguous ranges across recording jobs. When drawing instanced these are the instances,
+	// and each range is one instanced draw
+	uint32_t mDrawCount = 1;
+
+	// Where each draw goes on the grid when not drawing instanced
+	MatrixArray mDrawPlacements;
+
+	// Record draws [firstDraw, firstDraw + drawCount) along with the state they need, into a primary or secondary
+	void recordDraws(vk::CommandBuffer& cmd, size_t frame, uint32_t firstDraw, uint32_t drawCount);
+
+	// Command buffers that still reference a retired framebuffer, recorded again right before their next submit
+	std::vector<bool> mCommandBufferDirty;
+
+	// Record the given primaries (and their secondaries), none of them may be pending on the GPU
+	void recordCommands(const std::vector<size_t>& commandBuffers);
+
 	vk::Extent2D mSurfaceSize;
 	vk::Rect2D mRenderArea;
 	vk::Viewport mViewport;
@@ -159,7 +503,7 @@ protected:
 	vk::ColorSpaceKHR mSurfaceColorSpace;
 	vk::Format mSurfaceDepthFormat;
 	vk::Image mDepthImage;
-	vk::DeviceMemory mDepthImageMemory;
+	DeviceAllocation mDepthImageMemory;
 
 	vk::DescriptorPool mDescriptorPool;
 	std::vector<vk::DescriptorSetLayout> mDescriptorSetLayouts;
@@ -177,43 +521,165 @@ protected:
 	vk::Pipeline mPipeline;
 	vk::PipelineLayout mPipelineLayout;
 
+	// Load the pipeline cache from disk if it was written by this exact driver and device
+	void createPipelineCache();
+
+	// Save the pipeline cache to disk so the next launch can skip pipeline compilation
+	void savePipelineCache();
+
+	// Create the shader modules and graphics pipeline from the current triangle shaders
+	void createPipeline();
+
 	// Sync
-	vk::Semaphore mPresentCompleteSemaphore;
-	vk::Semaphore mRenderCompleteSemaphore;
-	std::vector<vk::Fence> mWaitFences;
+	struct FrameData {
+		vk::Semaphore presentCompleteSemaphore;
+		vk::Semaphore renderCompleteSemaphore;
+		vk::Fence waitFence;
+
+		// Profiler frame that last submitted this frame's timestamps, if any are still unread
+		uint64_t profilerFrame = 0;
+		bool timestampsPending = false;
+
+		// Serial of the last submission made with this frame
+		uint64_t submitSerial = 0;
+
+		// Host visible copy of the image this frame rendered, sized to the surface it was created for
+		vk::Buffer readbackBuffer;
+		DeviceAllocation readbackMemory;
+		vk::Extent2D readbackExtent;
+		bool readbackPending = false;
+	};
+
+	// Frames the CPU is recording / the GPU is executing, independent of the swapchain image index
+	std::vector<FrameData> mFrames;
+	uint32_t mFrameIndex;
+
+	// GPU Timestamps, a begin / end pair around the render pass for each frame in flight
+	vk::QueryPool mTimestampQueryPool;
+	float mTimestampPeriod = 0.0f;
+	uint64_t mTimestampMask = 0;
+
+	// Read back the render pass time of the last submission using this frame, once its fence has signaled
+	void readTimestamps(uint32_t frameIndex);
+
+	// Swapchain images can be copied from and are in a format readback hands out
+	bool mReadbackSupported = false;
+
+	// Whether command buffers of this frame copy the image into its readback buffer
+	bool hasReadback(size_t frameIndex) const;
+
+	// (Re)create the frame's readback buffer for the current surface size, the frame must not be in flight
+	void createReadbackBuffer(uint32_t frameIndex);
+
+	// Copy the rendered image into the frame's readback buffer, after the render pass
+	void recordReadback(vk::CommandBuffer& cmd, size_t frameIndex, size_t image);
+
+	// Hand the last submission's pixels to the readback callback, once its fence has signaled
+	void deliverReadback(uint32_t frameIndex);
+
+	// Shared by initializeAPI and initializeHeadlessAPI, window is null when headless
+	void initializeDevice(xwin::Window* window);
 
 	// Swpachain
 	struct SwapChainBuffer {
 		vk::Image image;
 		std::array<vk::ImageView, 2> views;
 		vk::Framebuffer frameBuffer;
+
+		// Only used by offscreen images when headless, swapchain images are owned by the swapchain
+		DeviceAllocation memory;
 	};
 
 	std::vector<SwapChainBuffer> mSwapchainBuffers;
 
+	// Surface sized objects replaced by a resize, destroyed once every frame submitted before the resize has finished
+	struct RetiredSurface {
+		vk::SwapchainKHR swapchain;
+		std::vector<SwapChainBuffer> buffers;
+		vk::Image depthImage;
+		DeviceAllocation depthMemory;
+		uint64_t submitSerial;
+	};
+
+	std::vector<RetiredSurface> mRetiredSurfaces;
+
+	// Submissions made so far, and the latest one known to have finished on the GPU
+	uint64_t mSubmitSerial = 0;
+	uint64_t mCompletedSerial = 0;
+
+	// Move the swapchain, framebuffers and depth attachment aside, mSwapchain stays set so it can be handed to its replacement
+	void retireSurface();
+
+	// Destroy the retired surfaces the GPU is done with, or all of them
+	void destroyRetiredSurfaces(bool all);
+
+	// Pipelines replaced by a shader reload, destroyed once every frame submitted before the reload has finished
+	struct RetiredPipeline {
+		vk::Pipeline pipeline;
+		vk::ShaderModule vertModule;
+		vk::ShaderModule fragModule;
+		uint64_t submitSerial;
+	};
+
+	std::vector<RetiredPipeline> mRetiredPipelines;
+
+	// Destroy the retired pipelines the GPU is done with, or all of them
+	void destroyRetiredPipelines(bool all);
+
+	// VK_GOOGLE_display_timing, only loaded when measuring latency and the device supports it
+	PFN_vkGetPastPresentationTimingGOOGLE mGetPastPresentationTiming = nullptr;
+
+	// Hand the display times the swapchain reported since the last call to the latency tracker
+	void readPresentationTimings();
+
+	// Device memory for every buffer and image in this example
+	DeviceMemoryAllocator mAllocator;
+
 	// Vertex buffer and attributes
 	struct {
-		vk::DeviceMemory memory;															// Handle to the device memory for this buffer
+		DeviceAllocation memory;															// Sub-allocation of device memory for this buffer
 		vk::Buffer buffer;																// Handle to the Vulkan buffer object that the memory is bound to
 		vk::PipelineVertexInputStateCreateInfo inputState;
-		vk::VertexInputBindingDescription inputBinding;
+		std::vector<vk::VertexInputBindingDescription> inputBindings;
 		std::vector<vk::VertexInputAttributeDescription> inputAttributes;
 	} mVertices;
 
 	// Index buffer
 	struct
 	{
-		vk::DeviceMemory memory;
+		DeviceAllocation memory;
 		vk::Buffer buffer;
 		uint32_t count;
 	} mIndices;
 
-	// Uniform block object
+	// Uniform ring buffer, persistently mapped and split into one region per frame in flight.
+	// Each frame linearly sub-allocates its region and binds the results as dynamic offsets.
 	struct {
-		vk::DeviceMemory memory;
+		DeviceAllocation memory;
 		vk::Buffer buffer;
+		uint8_t* mapped;
+		vk::DeviceSize alignment;
+		vk::DeviceSize frameSize;
+		vk::DeviceSize head;
+		vk::DeviceSize end;
 		vk::DescriptorBufferInfo descriptor;
-	}  mUniformDataVS;
+	} mUniformRing;
+
+	// Start sub-allocating from the given frame's region of the uniform ring
+	void resetUniformRing(uint32_t frameIndex);
+
+	// Reserve size bytes of the uniform ring, returns the offset to write them at
+	vk::DeviceSize allocateUniforms(size_t size);
+
+	// Copy data into the uniform ring, returns the dynamic offset to bind it with
+	uint32_t pushUniforms(const void* data, size_t size);
+
+	// Where the instance stream starts in each frame's region of the uniform ring, right after uboVS.
+	// The ring is also bound as vertex buffer 1, stepping once per instance
+	vk::DeviceSize mInstanceOffset = 0;
+
+	// Bytes between the draws' uboVS copies at the start of each frame's region, a uboVS padded to the dynamic offset alignment
+	vk::DeviceSize mDrawStride = 0;
 
 #elif defined(XGFX_DIRECTX12)
 
@@ -300,24 +766,165 @@ protected:
 	//Initialization
 	xgfx::OpenGLState mOGLState;
 
+	// EGLDisplay, EGLContext, EGLSurface - Only used when rendering headless
+	void* mEGLDisplay;
+	void* mEGLContext;
+	void* mEGLSurface;
+
 	unsigned mWidth, mHeight;
 
-	GLuint mFrameBuffer;
-	GLuint mFrameBufferTex;
-	GLuint mRenderBufferDepth;
+	// Offscreen target, only created when post processing needs it or there's no window
+	bool mOffscreen = false;
+	GLuint mFrameBuffer = 0;
+	GLuint mFrameBufferTex = 0;
+	GLuint mRenderBufferDepth = 0;
 
 	// Resources
-	GLuint mVertexShader;
-	GLuint mFragmentShader;
 	GLuint mProgram;
 	GLuint mVertexArray;
 	GLuint mVertexBuffer;
 	GLuint mIndexBuffer;
 
-	GLuint mUniformUBO;
+	// Multi-draw variant of mProgram, reads each draw's placement from a storage buffer with gl_DrawID
+	GLuint mBatchProgram = 0;
+
+	// Compile and link assets/shaders/<name>.vert.glsl and <fragmentName>.frag.glsl (<name> by default),
+	// or load them from the program binary cache, returns 0 if linking fails
+	GLuint createProgram(const std::string& name, const std::string& fragmentName = "");
+
+	// Build mProgram, the instanced draw's when drawing instanced
+	GLuint createMainProgram();
+
+	// Link a program from a cached binary if one matches the key, returns false when it has to be compiled instead
+	bool loadProgramBinary(GLuint program, const std::string& name, uint64_t key);
+
+	// Save a linked program's binary so the next launch can skip compiling GLSL
+	void saveProgramBinary(GLuint program, const std::string& name, uint64_t key);
+
+	// Uniform ring buffer, one region more than the frames in flight so the CPU writes one while the GPU reads the rest.
+	// With GL_ARB_buffer_storage it stays persistently mapped and a fence per region guards reuse,
+	// otherwise the buffer is orphaned every frame and the driver hands out fresh storage.
+	struct {
+		GLuint buffer;
+		uint8_t* mapped;
+		GLsizeiptr alignment;
+		GLsizeiptr frameSize;
+		GLsizeiptr head;
+		GLsizeiptr end;
+		size_t region;
+		std::vector<GLsync> fences;
+	} mUniformRing;
+
+	// Move on to the next region of the uniform ring, waiting for the GPU if it's still reading it
+	void resetUniformRing();
+
+	// Reserve size bytes of the uniform ring, returns the offset to write them at and bind them with
+	GLintptr allocateUniforms(size_t size);
+
+	// Copy data into the uniform ring, returns the offset to bind it with
+	GLintptr pushUniforms(const void* data, size_t size);
+
+	// Write every visible draw's model view projection matrix, and its indirect command for the multi-draw, into the uniform ring
+	void updateTransforms();
+
+	// Write every instance's InstanceData into the uniform ring and point the instance attributes at it
+	void updateInstances();
+
+	// Staging for updateInstances when the ring isn't persistently mapped
+	std::vector<uint8_t> mInstanceStaging;
+
+	// Latency tag of the frame drawn last, the swap at the start of the next render() presents it
+	uint32_t mLatencyTag = 0;
+
+	// Fence the current region once the draws reading it are submitted
+	void fenceUniformRing();
+
+	// GPU queries for one frame, read back a few frames later once they're available so render() never stalls on them.
+	// Timestamps bracket the main pass and the blit, the statistics queries wrap the main pass.
+	struct GpuQueries
+	{
+		GLuint timestamps[3];
+		GLuint statistics[6];
+		uint64_t profilerFrame;
+		bool pending;
+		bool blit;
+	};
+	std::vector<GpuQueries> mQueries;
+	size_t mQueryIndex = 0;
+	bool mTimerQueries = false;
+	bool mStatisticsQueries = false;
+	bool mHasPipelineStatistics = false;
+	PipelineStatistics mPipelineStatistics;
+
+	void createQueries();
+	void destroyQueries();
+
+	// Hand finished queries to the profiler, oldest first, stopping at the first one that isn't available yet
+	void readQueries();
+
+	// Pixel pack buffers frames are read back through, glReadPixels into one returns straight away
+	// and its fence says when the pixels can be mapped without stalling
+	struct ReadbackBuffer
+	{
+		GLuint buffer;
+		GLsync fence;
+		GLsizeiptr size;
+		ReadbackImage image;
+	};
+	std::vector<ReadbackBuffer> mReadbacks;
+	size_t mReadbackIndex = 0;
+
+	// Start copying the finished frame into the next readback buffer
+	void copyReadback();
+
+	// Hand finished readbacks to the callback, oldest first, stopping at the first one the GPU is still on
+	void deliverReadbacks();
+
+	// Pack the meshes into the vertex / index buffers and describe them in mVertexArray, with GL 4.5 direct state access when available
+	void createVertexArray();
+
+	// A mesh's range of the shared vertex and index buffers
+	struct Mesh
+	{
+		GLuint indexCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+
+		// Bounding sphere around the mesh's origin
+		float radius;
+	};
+	std::vector<Mesh> mMeshes;
+
+	// Layout glMultiDrawElementsIndirect reads its commands in
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
 
-	GLint mPositionAttrib;
-	GLint mColorAttrib;
+	// Every draw in the scene, culled against the view frustum each frame. With GL_ARB_multi_draw_indirect and
+	// GL_ARB_shader_draw_parameters the visible draws are a single glMultiDrawElementsIndirect, otherwise a
+	// glDrawElementsBaseVertex each. Each frame every visible draw's model view projection matrix is written into the
+	// uniform ring, read as an array of draw data by the multi-draw, or bound as uboVS one draw at a time.
+	// The multi-draw's commands are streamed into the ring next to them, packed in the same order.
+	struct {
+		bool multiDrawIndirect;
+		std::vector<DrawElementsIndirectCommand> commands;
+		Scene scene;
+		std::vector<uint32_t> visible;
+		size_t visibleCount;
+		GLintptr transformOffset;
+		GLsizeiptr transformStride;
+		GLintptr commandOffset;
+		std::vector<uint8_t> staging;
+	} mBatch;
+
+	void createBatch();
+	void destroyBatch();
+	void drawBatch();
 
 #elif defined(XGFX_METAL)
 	// MTLDevice - The device (aka GPU) we're using to render
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "Transforms.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Scene
+
+// View frustum as six planes (a, b, c, d), normalized so a point is inside a plane where a x + b y + c z + d >= 0
+struct Frustum
+{
+	float planes[6][4];
+
+	// Left, right, bottom, top, near and far planes of a view projection matrix with OpenGL clip space (-w <= z <= w)
+	static Frustum fromMatrix(const Matrix4& viewProjection)
+	{
+		auto row = [&](int r, int c) { return viewProjection.getElem(c, r); };
+
+		Frustum frustum;
+		for (int plane = 0; plane < 6; ++plane)
+		{
+			int axis = plane / 2;
+			float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+			for (int c = 0; c < 4; ++c)
+			{
+				frustum.planes[plane][c] = row(3, c) + sign * row(axis, c);
+			}
+
+			float length = std::sqrt(frustum.planes[plane][0] * frustum.planes[plane][0] +
+				frustum.planes[plane][1] * frustum.planes[plane][1] + frustum.planes[plane][2] * frustum.planes[plane][2]);
+			for (int c = 0; c < 4; ++c)
+			{
+				frustum.planes[plane][c] /= length;
+			}
+		}
+		return frustum;
+	}
+};
+
+/**
+ * Objects in the scene as a structure of arrays: their transforms, and world space bounding spheres and
+ * axis aligned boxes kept in sync with them. Each bounds array is contiguous and padded like the transforms,
+ * so culling reads whole cache lines of one attribute and tests a batch of objects per SIMD register.
+ */
+class Scene
+{
+public:
+	void resize(size_t count)
+	{
+		mTransforms.resize(count);
+		size_t capacity = mTransforms.capacity();
+		for (std::vector<float>* bounds : { &mCenterX, &mCenterY, &mCenterZ, &mRadius, &mExtentX, &mExtentY, &mExtentZ })
+		{
+			bounds->assign(capacity, 0.0f);
+		}
+	}
+
+	size_t size() const
+	{
+		return mTransforms.size();
+	}
+
+	// Objects padded up to a multiple of the widest SIMD batch, the size of the visible list cull() writes
+	size_t capacity() const
+	{
+		return mTransforms.capacity();
+	}
+
+	// Place an object, its bounds are given as a sphere in its local space.
+	// The world space box is the one around that sphere, which also holds however the object turns in its local space.
+	void setObject(size_t index, const Matrix4& transform, const Vector3& center, float radius)
+	{
+		mTransforms.set(index, transform);
+
+		float world[3];
+		float extents[3];
+		float scale = 0.0f;
+		for (int row = 0; row < 3; ++row)
+		{
+			world[row] = transform.getElem(3, row);
+			extents[row] = 0.0f;
+			for (int col = 0; col < 3; ++col)
+			{
+				float local = col == 0 ? center.getX() : (col == 1 ? center.getY() : center.getZ());
+				world[row] += transform.getElem(col, row) * local;
+				extents[row] += std::fabs(transform.getElem(col, row)) * radius;
+			}
+		}
+		for (int col = 0; col < 3; ++col)
+		{
+			float axis = std::sqrt(transform.getElem(col, 0) * transform.getElem(col, 0) +
+				transform.getElem(col, 1) * transform.getElem(col, 1) + transform.getElem(col, 2) * transform.getElem(col, 2));
+			scale = std::max(scale, axis);
+		}
+
+		mCenterX[index] = world[0];
+		mCenterY[index] = world[1];
+		mCenterZ[index] = world[2];
+		mRadius[index] = scale * radius;
+		mExtentX[index] = extents[0];
+		mExtentY[index] = extents[1];
+		mExtentZ[index] = extents[2];
+	}
+
+	const MatrixArray& getTransforms() const
+	{
+		return mTransforms;
+	}
+
+	// Write the indices of objects inside or touching the frustum to visible in increasing order, returns how many.
+	// An object is culled as soon as its sphere or its box is entirely outside one plane. visible needs capacity()
+	// entries, the ones past the returned count are scratch. With AVX2 that's 8 objects per iteration, compacted
+	// with one permute from a table indexed by the lane mask.
+	size_t cull(const Frustum& frustum, uint32_t* visible) const
+	{
+		size_t count = size();
+		size_t visibleCount = 0;
+
+#if defined(XGFX_SIMD_AVX2)
+		const CompactionTable& table = getCompactionTable();
+
+		__m256 planes[6][7];
+		for (int p = 0; p < 6; ++p)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+			}
+			for (int c = 0; c < 3; ++c)
+			{
+				planes[p][4 + c] = _mm256_set1_ps(std::fabs(frustum.planes[p][c]));
+			}
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		for (size_t first = 0; first < count; first += 8)
+		{
+			__m256 x = _mm256_loadu_ps(mCenterX.data() + first);
+			__m256 y = _mm256_loadu_ps(mCenterY.data() + first);
+			__m256 z = _mm256_loadu_ps(mCenterZ.data() + first);
+			__m256 radius = _mm256_loadu_ps(mRadius.data() + first);
+			__m256 ex = _mm256_loadu_ps(mExtentX.data() + first);
+			__m256 ey = _mm256_loadu_ps(mExtentY.data() + first);
+			__m256 ez = _mm256_loadu_ps(mExtentZ.data() + first);
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				__m256 distance = _mm256_fmadd_ps(planes[p][0], x, _mm256_fmadd_ps(planes[p][1], y, _mm256_fmadd_ps(planes[p][2], z, planes[p][3])));
+				__m256 boxReach = _mm256_fmadd_ps(planes[p][4], ex, _mm256_fmadd_ps(planes[p][5], ey, _mm256_mul_ps(planes[p][6], ez)));
+				__m256 reach = _mm256_min_ps(radius, boxReach);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_GE_OQ));
+			}
+
+			unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(inside));
+			if (count - first < 8)
+			{
+				// Padding lanes are never visible
+				mask &= (1u << (count - first)) - 1;
+			}
+
+			__m256i indices = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(first)), lanes);
+			__m256i permutation = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table.permutations[mask]));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(visible + visibleCount), _mm256_permutevar8x32_epi32(indices, permutation));
+			visibleCount += table.counts[mask];
+		}
+#else
+		for (size_t i = 0; i < count; ++i)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6; ++p)
+			{
+				const float* plane = frustum.planes[p];
+				float distance = plane[0] * mCenterX[i] + plane[1] * mCenterY[i] + plane[2] * mCenterZ[i] + plane[3];
+				float boxReach = std::fabs(plane[0]) * mExtentX[i] + std::fabs(plane[1]) * mExtentY[i] + std::fabs(plane[2]) * mExtentZ[i];
+				inside &= distance + std::min(mRadius[i], boxReach) >= 0.0f;
+			}
+
+			// Branchless, the slot is overwritten by the next object if this one is culled
+			visible[visibleCount] = static_cast<uint32_t>(i);
+			visibleCount += inside ? 1 : 0;
+		}
+#endif
+
+		return visibleCount;
+	}
+
+protected:
+#if defined(XGFX_SIMD_AVX2)
+	// For every 8 bit lane mask, the lanes that are set moved to the front, and how many there are
+	struct CompactionTable
+	{
+		uint32_t permutations[256][8];
+		uint32_t counts[256];
+
+		CompactionTable()
+		{
+			for (unsigned mask = 0; mask < 256; ++mask)
+			{
+				unsigned count = 0;
+				for (unsigned lane = 0; lane < 8; ++lane)
+				{
+					if (mask & (1u << lane))
+					{
+						permutations[mask][count++] = lane;
+					}
+				}
+				counts[mask] = count;
+				for (unsigned lane = count; lane < 8; ++lane)
+				{
+					permutations[mask][lane] = 0;
+				}
+			}
+		}
+	};
+
+	static const CompactionTable& getCompactionTable()
+	{
+		static const CompactionTable table;
+		return table;
+	}
+#endif
+
+	MatrixArray mTransforms;
+
+	// World space bounding spheres and the half extents of boxes sharing their centers
+	std::vector<float> mCenterX;
+	std::vector<float> mCenterY;
+	std::vector<float> mCenterZ;
+	std::vector<float> mRadius;
+	std::vector<float> mExtentX;
+	std::vector<float> mExtentY;
+	std::vector<float> mExtentZ;
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Shader compilers, on the PATH (such as from the Vulkan SDK) unless CMake built them with XGFX_BUILD_SHADERS
+#if !defined(XGFX_GLSLANG_VALIDATOR_PATH)
+#define XGFX_GLSLANG_VALIDATOR_PATH "glslangValidator"
+#endif
+
+#if !defined(XGFX_SPIRV_CROSS_PATH)
+#define XGFX_SPIRV_CROSS_PATH "spirv-cross"
+#endif
+
+// Shader Watcher
+
+/**
+ * Watches a shader folder for shader hot reload. Saved GLSL sources (<program>.vert / .frag) are
+ * compiled to SPIR-V with glslangValidator on the watcher's thread, then cross compiled with SPIRV-Cross
+ * if the backend loads GLSL. Whenever a compiled shader the backend loads changes, rebuilt here or
+ * edited by hand, its program is queued for the render thread, which swaps it in at the start of a
+ * frame without ever waiting on a compiler. Uses inotify on Linux and polls file times elsewhere.
+ */
+class ShaderWatcher
+{
+public:
+	~ShaderWatcher()
+	{
+		stop();
+	}
+
+	// Watch the programs' sources and compiled shaders (<program>.<stage>.<compiledExtension>) in directory
+	void start(const std::string& directory, const std::vector<std::string>& programs, const std::string& compiledExtension)
+	{
+		stop();
+
+		mDirectory = directory;
+		mCompiledExtension = compiledExtension;
+		mFiles.clear();
+		for (const std::string& program : programs)
+		{
+			for (const char* stage : { "vert", "frag" })
+			{
+				std::string source = program + "." + stage;
+				mFiles.push_back(WatchedFile{ source, program, true, getModifiedTime(source) });
+				std::string compiled = source + "." + compiledExtension;
+				mFiles.push_back(WatchedFile{ compiled, program, false, getModifiedTime(compiled) });
+			}
+		}
+
+		mQuit = false;
+		mThread = std::thread([this]() { watchLoop(); });
+	}
+
+	void stop()
+	{
+		mQuit = true;
+		if (mThread.joinable())
+		{
+			mThread.join();
+		}
+	}
+
+	// Programs with a changed compiled shader since the last call, cheap to call every frame
+	std::vector<std::string> takeChangedPrograms()
+	{
+		std::vector<std::string> programs;
+		if (mHasChanges.load(std::memory_order_acquire))
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			programs.swap(mChangedPrograms);
+			mHasChanges = false;
+		}
+		return programs;
+	}
+
+protected:
+	struct WatchedFile
+	{
+		std::string name;
+		std::string program;
+
+		// GLSL source to compile, otherwise a compiled shader the backend loads
+		bool source;
+
+		// Only used when polling
+		time_t modified;
+	};
+
+	void watchLoop()
+	{
+#if defined(__linux__)
+		mInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		// Editors either write files in place or rename a temporary over them
+		if (mInotify < 0 || inotify_add_watch(mInotify, mDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			std::cout << "Shader hot reload can't watch " << mDirectory << "\n";
+			if (mInotify >= 0)
+			{
+				close(mInotify);
+			}
+			return;
+		}
+#endif
+
+		std::vector<size_t> changed;
+		while (!mQuit)
+		{
+			waitForChanges(100, changed);
+			if (changed.empty())
+			{
+				continue;
+			}
+
+			// Saves come in bursts (both stages, or the compiler's own outputs), let them settle first
+			size_t count;
+			do
+			{
+				count = changed.size();
+				waitForChanges(50, changed);
+			} while (changed.size() != count && !mQuit);
+
+			for (size_t file : changed)
+			{
+				if (mFiles[file].source)
+				{
+					// A successful compile writes the compiled shader, which shows up as its own change
+					compile(mFiles[file]);
+				}
+				else
+				{
+					queueProgram(mFiles[file].program);
+				}
+			}
+			changed.clear();
+		}
+
+#if defined(__linux__)
+		close(mInotify);
+#endif
+	}
+
+	// Wait up to timeoutMs for watched files to change, adding the ones not already in changed
+	void waitForChanges(int timeoutMs, std::vector<size_t>& changed)
+	{
+		auto addChange = [&](size_t file)
+		{
+			if (std::find(changed.begin(), changed.end(), file) == changed.end())
+			{
+				changed.push_back(file);
+			}
+		};
+
+#if defined(__linux__)
+		pollfd descriptor = { mInotify, POLLIN, 0 };
+		if (poll(&descriptor, 1, timeoutMs) <= 0)
+		{
+			return;
+		}
+
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(mInotify, buffer, sizeof(buffer))) > 0)
+		{
+			for (char* ptr = buffer; ptr < buffer + length;)
+			{
+				const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+				ptr += sizeof(inotify_event) + event->len;
+				if (event->len == 0)
+				{
+					continue;
+				}
+
+				for (size_t i = 0; i < mFiles.size(); ++i)
+				{
+					if (mFiles[i].name == event->name)
+					{
+						addChange(i);
+					}
+				}
+			}
+		}
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+		for (size_t i = 0; i < mFiles.size(); ++i)
+		{
+			time_t modified = getModifiedTime(mFiles[i].name);
+			if (modified != mFiles[i].modified)
+			{
+				mFiles[i].modified = modified;
+				addChange(i);
+			}
+		}
+#endif
+	}
+
+	time_t getModifiedTime(const std::string& name) const
+	{
+		struct stat info;
+		return stat((mDirectory + "/" + name).c_str(), &info) == 0 ? info.st_mtime : 0;
+	}
+
+	// Same steps as the Shaders target in CMakeLists.txt, compiler errors go to the console
+	bool compile(const WatchedFile& file)
+	{
+		std::string source = mDirectory + "/" + file.name;
+		std::cout << "Compiling " << file.name << "\n";
+
+		if (!runTool(XGFX_GLSLANG_VALIDATOR_PATH, "-V \"" + source + "\" -o \"" + source + ".spv\""))
+		{
+			std::cout << "Failed to compile " << file.name << ", keeping the running version\n";
+			return false;
+		}
+
+		if (mCompiledExtension == "glsl" &&
+			!runTool(XGFX_SPIRV_CROSS_PATH, "\"" + source + ".spv\" --version 310 --es --output \"" + source + ".glsl\""))
+		{
+			std::cout << "Failed to cross compile " << file.name << " to GLSL\n";
+			return false;
+		}
+		return true;
+	}
+
+	static bool runTool(const std::string& tool, const std::string& arguments)
+	{
+		std::string command = "\"" + tool + "\" " + arguments;
+#if defined(_WIN32)
+		// cmd.exe strips the outermost quotes, so wrap the command to keep the quoted paths intact
+		command = "\"" + command + "\"";
+#endif
+		return std::system(command.c_str()) == 0;
+	}
+
+	void queueProgram(const std::string& program)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (std::find(mChangedPrograms.begin(), mChangedPrograms.end(), program) == mChangedPrograms.end())
+		{
+			mChangedPrograms.push_back(program);
+		}
+		mHasChanges = true;
+	}
+
+	std::string mDirectory;
+	std::string mCompiledExtension;
+	std::vector<WatchedFile> mFiles;
+
+	std::thread mThread;
+	std::atomic<bool> mQuit{ false };
+#if defined(__linux__)
+	int mInotify = -1;
+#endif
+
+	std::mutex mMutex;
+	std::vector<std::string> mChangedPrograms;
+	std::atomic<bool> mHasChanges{ false };
+};
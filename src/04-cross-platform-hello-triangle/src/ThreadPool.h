@@ -0,0 +1,128 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+// Thread Pool
+
+/**
+ * A fixed set of worker threads for fork / join work such as recording command buffers.
+ * parallelFor hands out job indices to the workers and the calling thread, then blocks
+ * until every job is done. Job indices, not threads, own per-job resources (like a command
+ * pool), so no job ever needs to know which thread it runs on.
+ */
+class ThreadPool
+{
+public:
+	~ThreadPool()
+	{
+		destroy();
+	}
+
+	void create(unsigned workerCount)
+	{
+		mQuit = false;
+		for (unsigned i = 0; i < workerCount; ++i)
+		{
+			mWorkers.emplace_back([this]() { workerLoop(); });
+		}
+	}
+
+	void destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQuit = true;
+		}
+		mWake.notify_all();
+
+		for (std::thread& worker : mWorkers)
+		{
+			worker.join();
+		}
+		mWorkers.clear();
+	}
+
+	// Threads that can run jobs at once, including the one calling parallelFor
+	unsigned getThreadCount() const
+	{
+		return static_cast<unsigned>(mWorkers.size()) + 1;
+	}
+
+	// Run func(jobIndex) for every jobIndex in [0, jobCount), returns once all of them finished
+	void parallelFor(unsigned jobCount, const std::function<void(unsigned)>& func)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			// Stragglers from the last call may still be checking for work
+			mDone.wait(lock, [this]() { return mActiveWorkers == 0; });
+
+			mJob = &func;
+			mJobCount = jobCount;
+			mNextJob = 0;
+			mCompletedJobs = 0;
+			mGeneration++;
+		}
+		mWake.notify_all();
+
+		runJobs();
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		mDone.wait(lock, [this]() { return mActiveWorkers == 0 && mCompletedJobs == mJobCount; });
+		mJob = nullptr;
+	}
+
+protected:
+	void workerLoop()
+	{
+		uint64_t generation = 0;
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [&]() { return mQuit || mGeneration != generation; });
+			if (mQuit)
+			{
+				return;
+			}
+			generation = mGeneration;
+			mActiveWorkers++;
+			lock.unlock();
+
+			runJobs();
+
+			lock.lock();
+			if (--mActiveWorkers == 0)
+			{
+				mDone.notify_all();
+			}
+		}
+	}
+
+	void runJobs()
+	{
+		for (unsigned job = mNextJob++; job < mJobCount; job = mNextJob++)
+		{
+			(*mJob)(job);
+			mCompletedJobs++;
+		}
+	}
+
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+
+	const std::function<void(unsigned)>* mJob = nullptr;
+	unsigned mJobCount = 0;
+	std::atomic<unsigned> mNextJob{ 0 };
+	std::atomic<unsigned> mCompletedJobs{ 0 };
+	unsigned mActiveWorkers = 0;
+	uint64_t mGeneration = 0;
+	bool mQuit = false;
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "vectormath.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Widest SIMD the build targets, AVX needs XGFX_AVX2 (or /arch:AVX, -mavx), x86-64 always has SSE2
+#if defined(__AVX__)
+#include <immintrin.h>
+#define XGFX_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define XGFX_SIMD_SSE 1
+#endif
+
+// AVX2 integer permutes along with FMA, which every AVX2 CPU has (MSVC's /arch:AVX2 doesn't define __FMA__)
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define XGFX_SIMD_AVX2 1
+#endif
+
+// Transforms
+
+/**
+ * Matrices stored as a structure of arrays, element (col, row) of every matrix is contiguous so SIMD
+ * kernels work on a batch of matrices per register (4 with SSE, 8 with AVX) with plain loads. The
+ * arrays are padded to a multiple of the widest batch, so kernels never need a scalar tail.
+ */
+class MatrixArray
+{
+public:
+	static const size_t Lanes = 8;
+
+	void resize(size_t count)
+	{
+		mCount = count;
+		mCapacity = (count + Lanes - 1) / Lanes * Lanes;
+		mElements.assign(16 * mCapacity, 0.0f);
+	}
+
+	size_t size() const
+	{
+		return mCount;
+	}
+
+	// Matrices padded up to a multiple of Lanes
+	size_t capacity() const
+	{
+		return mCapacity;
+	}
+
+	void set(size_t index, const Matrix4& matrix)
+	{
+		for (int col = 0; col < 4; ++col)
+		{
+			for (int row = 0; row < 4; ++row)
+			{
+				mElements[getElement(col, row) + index] = matrix.getElem(col, row);
+			}
+		}
+	}
+
+	// Element (col, row) of every matrix, capacity() floats
+	const float* getElements(int col, int row) const
+	{
+		return mElements.data() + getElement(col, row);
+	}
+
+protected:
+	size_t getElement(int col, int row) const
+	{
+		return static_cast<size_t>(col * 4 + row) * mCapacity;
+	}
+
+	size_t mCount = 0;
+	size_t mCapacity = 0;
+	std::vector<float> mElements;
+};
+
+namespace detail
+{
+	// One SIMD register of floats, each lane belongs to a different matrix
+#if defined(XGFX_SIMD_AVX)
+	struct FloatBatch
+	{
+		static const size_t Width = 8;
+		__m256 v;
+
+		static FloatBatch load(const float* p) { return { _mm256_loadu_ps(p) }; }
+		static FloatBatch broadcast(float f) { return { _mm256_set1_ps(f) }; }
+
+		static FloatBatch gather(const float* p, const uint32_t* indices)
+		{
+#if defined(XGFX_SIMD_AVX2)
+			return { _mm256_i32gather_ps(p, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices)), 4) };
+#else
+			return { _mm256_setr_ps(p[indices[0]], p[indices[1]], p[indices[2]], p[indices[3]], p[indices[4]], p[indices[5]], p[indices[6]], p[indices[7]]) };
+#endif
+		}
+		static FloatBatch zero() { return { _mm256_setzero_ps() }; }
+
+		// a * b + c
+		static FloatBatch multiplyAdd(FloatBatch a, FloatBatch b, FloatBatch c)
+		{
+#if defined(__FMA__)
+			return { _mm256_fmadd_ps(a.v, b.v, c.v) };
+#else
+			return { _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v) };
+#endif
+		}
+
+		// Transpose the 16 elements of 8 matrices back into 8 column major matrices
+		static void storeMatrices(const FloatBatch* elements, float (*matrices)[16])
+		{
+			for (int half = 0; half < 2; ++half)
+			{
+				const FloatBatch* r = elements + half * 8;
+				__m256 t0 = _mm256_unpacklo_ps(r[0].v, r[1].v);
+				__m256 t1 = _mm256_unpackhi_ps(r[0].v, r[1].v);
+				__m256 t2 = _mm256_unpacklo_ps(r[2].v, r[3].v);
+				__m256 t3 = _mm256_unpackhi_ps(r[2].v, r[3].v);
+				__m256 t4 = _mm256_unpacklo_ps(r[4].v, r[5].v);
+				__m256 t5 = _mm256_unpackhi_ps(r[4].v, r[5].v);
+				__m256 t6 = _mm256_unpacklo_ps(r[6].v, r[7].v);
+				__m256 t7 = _mm256_unpackhi_ps(r[6].v, r[7].v);
+
+				__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+				__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+				__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+				__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+				__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+				__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+				__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+				__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+				_mm256_storeu_ps(matrices[0] + half * 8, _mm256_permute2f128_ps(s0, s4, 0x20));
+				_mm256_storeu_ps(matrices[1] + half * 8, _mm256_permute2f128_ps(s1, s5, 0x20));
+				_mm256_storeu_ps(matrices[2] + half * 8, _mm256_permute2f128_ps(s2, s6, 0x20));
+				_mm256_storeu_ps(matrices[3] + half * 8, _mm256_permute2f128_ps(s3, s7, 0x20));
+				_mm256_storeu_ps(matrices[4] + half * 8, _mm256_permute2f128_ps(s0, s4, 0x31));
+				_mm256_storeu_ps(matrices[5] + half * 8, _mm256_permute2f128_ps(s1, s5, 0x31));
+				_mm256_storeu_ps(matrices[6] + half * 8, _mm256_permute2f128_ps(s2, s6, 0x31));
+				_mm256_storeu_ps(matrices[7] + half * 8, _mm256_permute2f128_ps(s3, s7, 0x31));
+			}
+		}
+	};
+#elif defined(XGFX_SIMD_SSE)
+	struct FloatBatch
+	{
+		static const size_t Width = 4;
+		__m128 v;
+
+		static FloatBatch load(const float* p) { return { _mm_loadu_ps(p) }; }
+		static FloatBatch broadcast(float f) { return { _mm_set1_ps(f) }; }
+		static FloatBatch gather(const float* p, const uint32_t* indices) { return { _mm_setr_ps(p[indices[0]], p[indices[1]], p[indices[2]], p[indices[3]]) }; }
+		static FloatBatch zero() { return { _mm_setzero_ps() }; }
+
+		// a * b + c
+		static FloatBatch multiplyAdd(FloatBatch a, FloatBatch b, FloatBatch c)
+		{
+			return { _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v) };
+		}
+
+		// Transpose the 16 elements of 4 matrices back into 4 column major matrices, one column at a time
+		static void storeMatrices(const FloatBatch* elements, float (*matrices)[16])
+		{
+			for (int col = 0; col < 4; ++col)
+			{
+				__m128 r0 = elements[col * 4 + 0].v;
+				__m128 r1 = elements[col * 4 + 1].v;
+				__m128 r2 = elements[col * 4 + 2].v;
+				__m128 r3 = elements[col * 4 + 3].v;
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				_mm_storeu_ps(matrices[0] + col * 4, r0);
+				_mm_storeu_ps(matrices[1] + col * 4, r1);
+				_mm_storeu_ps(matrices[2] + col * 4, r2);
+				_mm_storeu_ps(matrices[3] + col * 4, r3);
+			}
+		}
+	};
+#else
+	// No SIMD on this target (such as ARM), the same kernel one matrix at a time
+	struct FloatBatch
+	{
+		static const size_t Width = 1;
+		float v;
+
+		static FloatBatch load(const float* p) { return { *p }; }
+		static FloatBatch broadcast(float f) { return { f }; }
+		static FloatBatch gather(const float* p, const uint32_t* indices) { return { p[indices[0]] }; }
+		static FloatBatch zero() { return { 0.0f }; }
+
+		static FloatBatch multiplyAdd(FloatBatch a, FloatBatch b, FloatBatch c)
+		{
+			return { a.v * b.v + c.v };
+		}
+
+		static void storeMatrices(const FloatBatch* elements, float (*matrices)[16])
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				matrices[0][i] = elements[i].v;
+			}
+		}
+	};
+#endif
+}
+
+namespace detail
+{
+	// load(first, m) fills m with the 16 elements of the batch of matrices that ends up at output index first
+	template <typename LoadBatch>
+	inline void concatenateTransforms(const Matrix4& left, size_t count, LoadBatch load, const Matrix4& right, void* output, size_t stride)
+	{
+		typedef FloatBatch Batch;
+
+		// Every lane multiplies by the same left / right matrices
+		Batch l[16];
+		Batch r[16];
+		for (int col = 0; col < 4; ++col)
+		{
+			for (int row = 0; row < 4; ++row)
+			{
+				l[col * 4 + row] = Batch::broadcast(left.getElem(col, row));
+				r[col * 4 + row] = Batch::broadcast(right.getElem(col, row));
+			}
+		}
+
+		uint8_t* out = static_cast<uint8_t*>(output);
+		for (size_t first = 0; first < count; first += Batch::Width)
+		{
+			Batch m[16];
+			load(first, m);
+
+			// (left * m)(row, col) = sum over k of left(row, k) * m(k, col)
+			Batch lm[16];
+			for (int col = 0; col < 4; ++col)
+			{
+				for (int row = 0; row < 4; ++row)
+				{
+					Batch sum = Batch::zero();
+					for (int k = 0; k < 4; ++k)
+					{
+						sum = Batch::multiplyAdd(l[k * 4 + row], m[col * 4 + k], sum);
+					}
+					lm[col * 4 + row] = sum;
+				}
+			}
+
+			Batch result[16];
+			for (int col = 0; col < 4; ++col)
+			{
+				for (int row = 0; row < 4; ++row)
+				{
+					Batch sum = Batch::zero();
+					for (int k = 0; k < 4; ++k)
+					{
+						sum = Batch::multiplyAdd(lm[k * 4 + row], r[col * 4 + k], sum);
+					}
+					result[col * 4 + row] = sum;
+				}
+			}
+
+			// Back to one matrix after another, the padding lanes are dropped
+			float transformed[Batch::Width][16];
+			Batch::storeMatrices(result, transformed);
+			size_t batchCount = count - first < Batch::Width ? count - first : Batch::Width;
+			for (size_t i = 0; i < batchCount; ++i)
+			{
+				memcpy(out + (first + i) * stride, transformed[i], sizeof(transformed[i]));
+			}
+		}
+	}
+}
+
+// Write left * matrices[i] * right for every matrix as 16 column major floats, stride bytes apart starting at output.
+// A camera's view projection on the left and a shared model matrix on the right give one model view projection
+// matrix per object, computed a batch of objects at a time with 128 multiply adds per batch.
+inline void concatenateTransforms(const Matrix4& left, const MatrixArray& matrices, const Matrix4& right, void* output, size_t stride)
+{
+	detail::concatenateTransforms(left, matrices.size(), [&](size_t first, detail::FloatBatch* m)
+	{
+		for (int element = 0; element < 16; ++element)
+		{
+			m[element] = detail::FloatBatch::load(matrices.getElements(element / 4, element % 4) + first);
+		}
+	}, right, output, stride);
+}
+
+// The same for only the matrices listed in indices (such as the objects that survived culling), packed in that order
+inline void concatenateTransforms(const Matrix4& left, const MatrixArray& matrices, const uint32_t* indices, size_t count, const Matrix4& right, void* output, size_t stride)
+{
+	typedef detail::FloatBatch Batch;
+	detail::concatenateTransforms(left, count, [&](size_t first, Batch* m)
+	{
+		// The last batch repeats matrix 0 in its unused lanes rather than reading past the list
+		uint32_t padded[Batch::Width] = {};
+		const uint32_t* batch = indices + first;
+		if (count - first < Batch::Width)
+		{
+			std::copy(batch, indices + count, padded);
+			batch = padded;
+		}
+
+		for (int element = 0; element < 16; ++element)
+		{
+			m[element] = Batch::gather(matrices.getElements(element / 4, element % 4), batch);
+		}
+	}, right, output, stride);
+}
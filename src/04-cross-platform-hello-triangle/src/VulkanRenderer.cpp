@@ -41,9 +41,8 @@ uint32_t getQueueIndex(vk::PhysicalDevice& physicalDevice, vk::QueueFlagBits fla
 	return 0;
 }
 
-uint32_t getMemoryTypeIndex(vk::PhysicalDevice& physicalDevice, uint32_t typeBits, vk::MemoryPropertyFlags properties)
+uint32_t getMemoryTypeIndex(const vk::PhysicalDeviceMemoryProperties& gpuMemoryProps, uint32_t typeBits, vk::MemoryPropertyFlags properties)
 {
-	auto gpuMemoryProps = physicalDevice.getMemoryProperties();
 	for (uint32_t i = 0; i < gpuMemoryProps.memoryTypeCount; i++)
 	{
 		if ((typeBits & 1) == 1)
@@ -58,15 +57,285 @@ uint32_t getMemoryTypeIndex(vk::PhysicalDevice& physicalDevice, uint32_t typeBit
 	return 0;
 };
 
+// Readback hands out 8 bit RGBA or BGRA, anything else can't be read back
+bool isReadbackFormat(vk::Format format, bool& bgra)
+{
+	switch (format)
+	{
+	case vk::Format::eB8G8R8A8Unorm:
+	case vk::Format::eB8G8R8A8Srgb:
+		bgra = true;
+		return true;
+	case vk::Format::eR8G8B8A8Unorm:
+	case vk::Format::eR8G8B8A8Srgb:
+		bgra = false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool isPipelineCacheCompatible(const std::vector<char>& data, const vk::PhysicalDeviceProperties& properties)
+{
+	// Every pipeline cache starts with this header (VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+	struct PipelineCacheHeader
+	{
+		uint32_t headerLength;
+		uint32_t headerVersion;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	};
+
+	if (data.size() < sizeof(PipelineCacheHeader))
+	{
+		return false;
+	}
+
+	PipelineCacheHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+
+	// A driver update changes the UUID, so stale caches are thrown out instead of handed to the driver
+	return header.headerLength >= sizeof(PipelineCacheHeader) &&
+		header.headerVersion == static_cast<uint32_t>(VK_PIPELINE_CACHE_HEADER_VERSION_ONE) &&
+		header.vendorID == properties.vendorID &&
+		header.deviceID == properties.deviceID &&
+		memcmp(header.pipelineCacheUUID, &properties.pipelineCacheUUID[0], VK_UUID_SIZE) == 0;
+}
+
+// Device Memory Allocator
+
+void DeviceMemoryAllocator::create(vk::PhysicalDevice& physicalDevice, vk::Device& device, vk::DeviceSize blockSize)
+{
+	mDevice = device;
+	mMemoryProperties = physicalDevice.getMemoryProperties();
+	mBlockSize = blockSize;
+}
+
+void DeviceMemoryAllocator::destroy()
+{
+	for (Block& block : mBlocks)
+	{
+		if (block.memory)
+		{
+			releaseBlock(block);
+		}
+	}
+	mBlocks.clear();
+}
+
+void DeviceMemoryAllocator::releaseBlock(Block& block)
+{
+	if (block.mapped != nullptr)
+	{
+		mDevice.unmapMemory(block.memory);
+	}
+	mDevice.freeMemory(block.memory);
+
+	// The slot stays behind so allocations in other blocks keep their index, the next new block reuses it
+	block.memory = vk::DeviceMemory();
+	block.size = 0;
+	block.mapped = nullptr;
+	block.freeRanges.clear();
+}
+
+bool DeviceMemoryAllocator::allocateFromBlock(Block& block, vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& outOffset)
+{
+	// First fit through the free list
+	for (size_t i = 0; i < block.freeRanges.size(); ++i)
+	{
+		Range range = block.freeRanges[i];
+		vk::DeviceSize offset = (range.offset + alignment - 1) & ~(alignment - 1);
+		vk::DeviceSize padding = offset - range.offset;
+		if (padding + size > range.size)
+		{
+			continue;
+		}
+
+		// Split the range, alignment padding in front stays in the free list
+		vk::DeviceSize tail = range.size - padding - size;
+		block.freeRanges.erase(block.freeRanges.begin() + i);
+		if (tail > 0)
+		{
+			block.freeRanges.insert(block.freeRanges.begin() + i, Range{ offset + size, tail });
+		}
+		if (padding > 0)
+		{
+			block.freeRanges.insert(block.freeRanges.begin() + i, Range{ range.offset, padding });
+		}
+
+		outOffset = offset;
+		return true;
+	}
+	return false;
+}
+
+DeviceAllocation DeviceMemoryAllocator::allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, bool optimalImage)
+{
+	uint32_t memoryType = getMemoryTypeIndex(mMemoryProperties, requirements.memoryTypeBits, properties);
+
+	DeviceAllocation allocation;
+	allocation.size = requirements.size;
+
+	for (size_t i = 0; i < mBlocks.size(); ++i)
+	{
+		Block& block = mBlocks[i];
+		if (block.memoryType == memoryType && block.optimalImage == optimalImage &&
+			allocateFromBlock(block, requirements.size, requirements.alignment, allocation.offset))
+		{
+			allocation.block = static_cast<uint32_t>(i);
+			break;
+		}
+	}
+
+	// No block had room, so allocate a new one that fits at least this resource
+	if (allocation.block == ~0U)
+	{
+		const vk::MemoryType& type = mMemoryProperties.memoryTypes[memoryType];
+
+		// Small heaps (such as device local host visible memory) shouldn't be eaten by a single block
+		vk::DeviceSize heapSize = mMemoryProperties.memoryHeaps[type.heapIndex].size;
+
+		Block block;
+		block.size = std::max(std::min(mBlockSize, heapSize / 8), requirements.size);
+		block.memoryType = memoryType;
+		block.optimalImage = optimalImage;
+		block.allocationCount = 0;
+		block.memory = mDevice.allocateMemory(vk::MemoryAllocateInfo(block.size, memoryType));
+		block.mapped = nullptr;
+		block.freeRanges = { Range{ 0, block.size } };
+
+		// Host visible blocks stay mapped for their whole lifetime, a block can only be mapped once
+		if (type.propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+		{
+			block.mapped = static_cast<uint8_t*>(mDevice.mapMemory(block.memory, 0, VK_WHOLE_SIZE));
+		}
+
+		// Take the slot of a block that was given back to the driver if there is one
+		allocation.block = static_cast<uint32_t>(mBlocks.size());
+		for (size_t i = 0; i < mBlocks.size(); ++i)
+		{
+			if (!mBlocks[i].memory)
+			{
+				allocation.block = static_cast<uint32_t>(i);
+				break;
+			}
+		}
+		if (allocation.block == mBlocks.size())
+		{
+			mBlocks.push_back(block);
+		}
+		else
+		{
+			mBlocks[allocation.block] = block;
+		}
+		allocateFromBlock(mBlocks[allocation.block], requirements.size, requirements.alignment, allocation.offset);
+	}
+
+	Block& block = mBlocks[allocation.block];
+	block.allocationCount++;
+	allocation.memory = block.memory;
+	allocation.mapped = block.mapped != nullptr ? block.mapped + allocation.offset : nullptr;
+	return allocation;
+}
+
+void DeviceMemoryAllocator::free(DeviceAllocation& allocation)
+{
+	if (allocation.block >= mBlocks.size())
+	{
+		return;
+	}
+
+	Block& block = mBlocks[allocation.block];
+
+	// Return the range in offset order, then merge it with its neighbors so the free list never fragments
+	std::vector<Range>::iterator it = std::lower_bound(
+		block.freeRanges.begin(),
+		block.freeRanges.end(),
+		allocation.offset,
+		[](const Range& range, vk::DeviceSize offset) { return range.offset < offset; }
+	);
+	it = block.freeRanges.insert(it, Range{ allocation.offset, allocation.size });
+
+	std::vector<Range>::iterator next = it + 1;
+	if (next != block.freeRanges.end() && it->offset + it->size == next->offset)
+	{
+		it->size += next->size;
+		block.freeRanges.erase(next);
+	}
+
+	if (it != block.freeRanges.begin())
+	{
+		std::vector<Range>::iterator prev = it - 1;
+		if (prev->offset + prev->size == it->offset)
+		{
+			prev->size += it->size;
+			block.freeRanges.erase(it);
+		}
+	}
+
+	block.allocationCount--;
+
+	// Keep one empty block per memory type around for the next allocation, any other empty block goes back to the driver
+	if (block.allocationCount == 0)
+	{
+		for (size_t i = 0; i < mBlocks.size(); ++i)
+		{
+			const Block& other = mBlocks[i];
+			if (i != allocation.block && other.memory && other.allocationCount == 0 &&
+				other.memoryType == block.memoryType && other.optimalImage == block.optimalImage)
+			{
+				releaseBlock(block);
+				break;
+			}
+		}
+	}
+
+	allocation = DeviceAllocation();
+}
+
+DeviceMemoryStats DeviceMemoryAllocator::getStats() const
+{
+	DeviceMemoryStats stats;
+	for (const Block& block : mBlocks)
+	{
+		if (!block.memory)
+		{
+			continue;
+		}
+
+		vk::DeviceSize freeBytes = 0;
+		for (const Range& range : block.freeRanges)
+		{
+			freeBytes += range.size;
+		}
+
+		stats.blockCount++;
+		stats.allocationCount += block.allocationCount;
+		stats.blockBytes += block.size;
+		stats.usedBytes += block.size - freeBytes;
+	}
+	return stats;
+}
+
 
 // Renderer
 
-Renderer::Renderer(xwin::Window& window)
+Renderer::Renderer(xwin::Window& window, const RendererDesc& desc) : mDesc(desc)
 {
 	initializeAPI(window);
 	initializeResources();
 	setupCommands();
-	tStart = std::chrono::high_resolution_clock::now();
+	mFramePacer.setTargetFrameRate(mDesc.targetFrameRate);
+}
+
+Renderer::Renderer(const RendererDesc& desc) : mDesc(desc)
+{
+	mHeadless = true;
+	initializeHeadlessAPI();
+	initializeResources();
+	setupCommands();
+	mFramePacer.setTargetFrameRate(mDesc.targetFrameRate);
 }
 
 Renderer::~Renderer()
@@ -82,12 +351,23 @@ void Renderer::destroyAPI()
 {
 	// Command Pool
 	mDevice.destroyCommandPool(mCommandPool);
+	mRecordingThreads.destroy();
+	for (vk::CommandPool& pool : mJobCommandPools)
+	{
+		mDevice.destroyCommandPool(pool);
+	}
+
+	// Device Memory
+	mAllocator.destroy();
 
 	// Device
 	mDevice.destroy();
 
 	// Surface
-	mInstance.destroySurfaceKHR(mSurface);
+	if (mSurface)
+	{
+		mInstance.destroySurfaceKHR(mSurface);
+	}
 
 	// Instance
 	mInstance.destroy();
@@ -95,28 +375,87 @@ void Renderer::destroyAPI()
 
 void Renderer::destroyFrameBuffer()
 {
-	// Depth Attachment
-	mDevice.freeMemory(mDepthImageMemory);
-	mDevice.destroyImage(mDepthImage);
-	if (!mSwapchainBuffers.empty())
-	{
-		mDevice.destroyImageView(mSwapchainBuffers[0].views[1]);
-	}
+	retireSurface();
+	destroyRetiredSurfaces(true);
+}
+
+void Renderer::retireSurface()
+{
+	RetiredSurface retired;
+	retired.swapchain = mSwapchain;
+	retired.buffers.swap(mSwapchainBuffers);
+	retired.depthImage = mDepthImage;
+	retired.depthMemory = mDepthImageMemory;
+	retired.submitSerial = mSubmitSerial;
+	mRetiredSurfaces.push_back(retired);
+
+	mDepthImage = nullptr;
+	mDepthImageMemory = DeviceAllocation();
+}
 
-	// Image Attachments
-	for (size_t i = 0; i < mSwapchainBuffers.size(); ++i)
+void Renderer::destroyRetiredSurfaces(bool all)
+{
+	for (size_t i = 0; i < mRetiredSurfaces.size();)
 	{
-		mDevice.destroyImageView(mSwapchainBuffers[i].views[0]);
-		mDevice.destroyFramebuffer(mSwapchainBuffers[i].frameBuffer);
+		RetiredSurface& retired = mRetiredSurfaces[i];
+		if (!all && retired.submitSerial > mCompletedSerial)
+		{
+			++i;
+			continue;
+		}
+
+		// Image Attachments
+		for (SwapChainBuffer& buffer : retired.buffers)
+		{
+			mDevice.destroyImageView(buffer.views[0]);
+			mDevice.destroyFramebuffer(buffer.frameBuffer);
+			if (mHeadless)
+			{
+				mDevice.destroyImage(buffer.image);
+				mAllocator.free(buffer.memory);
+			}
+		}
+
+		// Depth Attachment, its view is shared by every buffer
+		if (!retired.buffers.empty())
+		{
+			mDevice.destroyImageView(retired.buffers[0].views[1]);
+		}
+		mDevice.destroyImage(retired.depthImage);
+		mAllocator.free(retired.depthMemory);
+
+		// Swapchain, once nothing presented from it is still in flight
+		if (retired.swapchain)
+		{
+			mDevice.destroySwapchainKHR(retired.swapchain);
+		}
+
+		mRetiredSurfaces.erase(mRetiredSurfaces.begin() + i);
 	}
 }
 
 void Renderer::destroyCommands()
 {
 	mDevice.freeCommandBuffers(mCommandPool, mCommandBuffers);
+	for (size_t job = 0; job < mSecondaryCommandBuffers.size(); ++job)
+	{
+		mDevice.freeCommandBuffers(mJobCommandPools[job], mSecondaryCommandBuffers[job]);
+	}
+	mSecondaryCommandBuffers.clear();
 }
 
 void Renderer::initializeAPI(xwin::Window& window)
+{
+	initializeDevice(&window);
+}
+
+void Renderer::initializeHeadlessAPI()
+{
+	// No surface or swapchain, frames are rendered into offscreen images
+	initializeDevice(nullptr);
+}
+
+void Renderer::initializeDevice(xwin::Window* window)
 {
 	/**
 	 * Initialize the Vulkan API by creating its various API entry points:
@@ -127,7 +466,7 @@ void Renderer::initializeAPI(xwin::Window& window)
 
 	std::vector<vk::ExtensionProperties> installedExtensions = vk::enumerateInstanceExtensionProperties();
 
-	std::vector<const char*> wantedExtensions =
+	std::vector<const char*> wantedSurfaceExtensions =
 	{
 		VK_KHR_SURFACE_EXTENSION_NAME,
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
@@ -153,6 +492,13 @@ void Renderer::initializeAPI(xwin::Window& window)
 #endif
 	};
 
+	// Headless instances don't need any surface extensions, so they also work on drivers like lavapipe with no WSI
+	std::vector<const char*> wantedExtensions = {};
+	if (window != nullptr)
+	{
+		wantedExtensions = wantedSurfaceExtensions;
+	}
+
 	std::vector<const char*> extensions = {};
 
 	findBestExtensions(installedExtensions, wantedExtensions, extensions);
@@ -198,11 +544,14 @@ void Renderer::initializeAPI(xwin::Window& window)
 	mQueueFamilyIndex = getQueueIndex(mPhysicalDevice, vk::QueueFlagBits::eGraphics);
 
 	// Surface
-	mSurface = xgfx::getSurface(&window, mInstance);
-	if (!mPhysicalDevice.getSurfaceSupportKHR(mQueueFamilyIndex, mSurface))
+	if (window != nullptr)
 	{
-		// Check if queueFamily supports this surface
-		return;
+		mSurface = xgfx::getSurface(window, mInstance);
+		if (!mPhysicalDevice.getSurfaceSupportKHR(mQueueFamilyIndex, mSurface))
+		{
+			// Check if queueFamily supports this surface
+			return;
+		}
 	}
 
 	// Queue Creation
@@ -215,10 +564,19 @@ void Renderer::initializeAPI(xwin::Window& window)
 	// Logical Device
 	std::vector<vk::ExtensionProperties> installedDeviceExtensions = mPhysicalDevice.enumerateDeviceExtensionProperties();
 
-	std::vector<const char*> wantedDeviceExtensions =
+	std::vector<const char*> wantedDeviceExtensions = {};
+	if (window != nullptr)
 	{
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME
-	};
+		wantedDeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+		// Its display times are CLOCK_MONOTONIC, which steady_clock only matches on Linux
+#if defined(__linux__)
+		if (mDesc.measureLatency)
+		{
+			wantedDeviceExtensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+		}
+#endif
+	}
 
 	std::vector<const char*> deviceExtensions = {};
 
@@ -231,11 +589,21 @@ void Renderer::initializeAPI(xwin::Window& window)
 	dinfo.setEnabledExtensionCount(static_cast<uint32_t>(deviceExtensions.size()));
 	mDevice = mPhysicalDevice.createDevice(dinfo);
 
-
+	// Device extension functions aren't exported by the loader
+	for (const char* extension : deviceExtensions)
+	{
+		if (std::string(extension) == VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME)
+		{
+			mGetPastPresentationTiming = reinterpret_cast<PFN_vkGetPastPresentationTimingGOOGLE>(mDevice.getProcAddr("vkGetPastPresentationTimingGOOGLE"));
+		}
+	}
 
 	// Queue
 	mQueue = mDevice.getQueue(mQueueFamilyIndex, 0);
 
+	// Device Memory, sub-allocated from 64 MB blocks
+	mAllocator.create(mPhysicalDevice, mDevice, 64 * 1024 * 1024);
+
 	// Command Pool
 	mCommandPool = mDevice.createCommandPool(
 		vk::CommandPoolCreateInfo(
@@ -244,16 +612,41 @@ void Renderer::initializeAPI(xwin::Window& window)
 		)
 	);
 
+	// Command pools are externally synchronized, so every recording job gets its own, the main thread takes part as one of the jobs
+	if (mDesc.recordingThreads > 1)
+	{
+		mRecordingThreads.create(mDesc.recordingThreads - 1);
+		mJobCommandPools.resize(mDesc.recordingThreads);
+		for (vk::CommandPool& pool : mJobCommandPools)
+		{
+			pool = mDevice.createCommandPool(
+				vk::CommandPoolCreateInfo(
+					vk::CommandPoolCreateFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer),
+					mQueueFamilyIndex
+				)
+			);
+		}
+	}
+
 	// Surface Attachement Formats
 
-	std::vector<vk::SurfaceFormatKHR> surfaceFormats = mPhysicalDevice.getSurfaceFormatsKHR(mSurface);
+	if (window != nullptr)
+	{
+		std::vector<vk::SurfaceFormatKHR> surfaceFormats = mPhysicalDevice.getSurfaceFormatsKHR(mSurface);
 
-	if (surfaceFormats.size() == 1 && surfaceFormats[0].format == vk::Format::eUndefined)
-		mSurfaceColorFormat = vk::Format::eB8G8R8A8Unorm;
-	else
-		mSurfaceColorFormat = surfaceFormats[0].format;
+		if (surfaceFormats.size() == 1 && surfaceFormats[0].format == vk::Format::eUndefined)
+			mSurfaceColorFormat = vk::Format::eB8G8R8A8Unorm;
+		else
+			mSurfaceColorFormat = surfaceFormats[0].format;
 
-	mSurfaceColorSpace = surfaceFormats[0].colorSpace;
+		mSurfaceColorSpace = surfaceFormats[0].colorSpace;
+	}
+	else
+	{
+		// Every implementation supports this as a color attachment
+		mSurfaceColorFormat = vk::Format::eR8G8B8A8Unorm;
+		mSurfaceColorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+	}
 
 	// Since all depth formats may be optional, we need to find a suitable depth format to use
 	// Start with the highest precision packed format
@@ -278,20 +671,65 @@ void Renderer::initializeAPI(xwin::Window& window)
 		}
 	}
 
+	// Sync, which also decides how many frames may be in flight
+	createSynchronization();
+
 	//Swapchain
-	const xwin::WindowDesc wdesc = window.getDesc();
-	setupSwapchain(wdesc.width, wdesc.height);
+	if (window != nullptr)
+	{
+		const xwin::WindowDesc wdesc = window->getDesc();
+		setupSwapchain(wdesc.width, wdesc.height);
+	}
+	else
+	{
+		setupSwapchain(mDesc.width, mDesc.height);
+	}
 	mCurrentBuffer = 0;
+	mFrameIndex = 0;
 
 	// Command Buffers
 	createCommands();
-
-	// Sync
-	createSynchronization();
 }
 
 void Renderer::setupSwapchain(unsigned width, unsigned height)
 {
+	if (mHeadless)
+	{
+		// Offscreen images stand in for the swapchain, one per frame in flight so each is guarded by that frame's fence
+		mSurfaceSize = vk::Extent2D(clamp(width, 1U, 8192U), clamp(height, 1U, 8192U));
+		mRenderArea = vk::Rect2D(vk::Offset2D(), mSurfaceSize);
+		mViewport = vk::Viewport(0.0f, 0.0f, static_cast<float>(mSurfaceSize.width), static_cast<float>(mSurfaceSize.height), 0, 1.0f);
+
+		mSwapchainBuffers.resize(mFrames.size());
+		for (SwapChainBuffer& buffer : mSwapchainBuffers)
+		{
+			buffer.image = mDevice.createImage(
+				vk::ImageCreateInfo(
+					vk::ImageCreateFlags(),
+					vk::ImageType::e2D,
+					mSurfaceColorFormat,
+					vk::Extent3D(mSurfaceSize.width, mSurfaceSize.height, 1),
+					1U,
+					1U,
+					vk::SampleCountFlagBits::e1,
+					vk::ImageTiling::eOptimal,
+					vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+					vk::SharingMode::eExclusive,
+					1,
+					&mQueueFamilyIndex,
+					vk::ImageLayout::eUndefined
+				)
+			);
+
+			buffer.memory = mAllocator.allocate(mDevice.getImageMemoryRequirements(buffer.image), vk::MemoryPropertyFlagBits::eDeviceLocal, true);
+			mDevice.bindImageMemory(buffer.image, buffer.memory.memory, buffer.memory.offset);
+		}
+
+		bool bgra;
+		mReadbackSupported = isReadbackFormat(mSurfaceColorFormat, bgra);
+		return;
+	}
+
 	// Setup viewports, Vsync
 	vk::Extent2D swapchainSize = vk::Extent2D(width, height);
 
@@ -314,15 +752,31 @@ void Renderer::setupSwapchain(unsigned width, unsigned height)
 		}
 	}
 
+	vk::PresentModeKHR wantedPresentMode = mDesc.presentMode == PresentMode::Fifo ? vk::PresentModeKHR::eFifo :
+		(mDesc.presentMode == PresentMode::Immediate ? vk::PresentModeKHR::eImmediate : vk::PresentModeKHR::eMailbox);
+	if (std::find(surfacePresentModes.begin(), surfacePresentModes.end(), wantedPresentMode) != surfacePresentModes.end())
+	{
+		presentMode = wantedPresentMode;
+	}
+
 	// Create Swapchain, Images, Frame Buffers
 
-	mDevice.waitIdle();
+	// On resize the previous swapchain was already retired, handing it over lets presentation carry on without a stall
 	vk::SwapchainKHR oldSwapchain = mSwapchain;
 
 	// Some devices can support more than 2 buffers, but during my tests they would crash on fullscreen ~ ag
 	// Tested on an NVIDIA 1080 and 165 Hz 2K display
 	uint32_t backbufferCount = clamp(surfaceCapabilities.maxImageCount, 1U, 2U);
 
+	// Readback copies straight out of the swapchain images, where the surface lets us
+	bool bgra;
+	vk::ImageUsageFlags imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+	mReadbackSupported = (surfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc) && isReadbackFormat(mSurfaceColorFormat, bgra);
+	if (mReadbackSupported)
+	{
+		imageUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+	}
+
 	mSwapchain = mDevice.createSwapchainKHR(
 		vk::SwapchainCreateInfoKHR(
 			vk::SwapchainCreateFlagsKHR(),
@@ -332,7 +786,7 @@ void Renderer::setupSwapchain(unsigned width, unsigned height)
 			mSurfaceColorSpace,
 			swapchainSize,
 			1,
-			vk::ImageUsageFlagBits::eColorAttachment,
+			imageUsage,
 			vk::SharingMode::eExclusive,
 			1,
 			&mQueueFamilyIndex,
@@ -349,14 +803,14 @@ void Renderer::setupSwapchain(unsigned width, unsigned height)
 	mViewport = vk::Viewport(0.0f, 0.0f, static_cast<float>(mSurfaceSize.width), static_cast<float>(mSurfaceSize.height), 0, 1.0f);
 
 
-	// Destroy previous swapchain
-	if (oldSwapchain != vk::SwapchainKHR(nullptr))
+	// The driver may create more images than we asked for
+	std::vector<vk::Image> swapchainImages = mDevice.getSwapchainImagesKHR(mSwapchain);
+
+	mSwapchainBuffers.resize(swapchainImages.size());
+	for (size_t i = 0; i < swapchainImages.size(); i++)
 	{
-		mDevice.destroySwapchainKHR(oldSwapchain);
+		mSwapchainBuffers[i].image = swapchainImages[i];
 	}
-
-	// Resize swapchain buffers for use later
-	mSwapchainBuffers.resize(backbufferCount);
 }
 
 void Renderer::initFrameBuffer()
@@ -384,17 +838,12 @@ void Renderer::initFrameBuffer()
 
 	// Search through GPU memory properies to see if this can be device local.
 
-	mDepthImageMemory = mDevice.allocateMemory(
-		vk::MemoryAllocateInfo(
-			depthMemoryReq.size,
-			getMemoryTypeIndex(mPhysicalDevice, depthMemoryReq.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal)
-		)
-	);
+	mDepthImageMemory = mAllocator.allocate(depthMemoryReq, vk::MemoryPropertyFlagBits::eDeviceLocal, true);
 
 	mDevice.bindImageMemory(
 		mDepthImage,
-		mDepthImageMemory,
-		0
+		mDepthImageMemory.memory,
+		mDepthImageMemory.offset
 	);
 
 	vk::ImageView depthImageView = mDevice.createImageView(
@@ -414,18 +863,14 @@ void Renderer::initFrameBuffer()
 		)
 	);
 
-	std::vector<vk::Image> swapchainImages = mDevice.getSwapchainImagesKHR(mSwapchain);
-
-	for (size_t i = 0; i < swapchainImages.size(); i++)
+	for (size_t i = 0; i < mSwapchainBuffers.size(); i++)
 	{
-		mSwapchainBuffers[i].image = swapchainImages[i];
-
 		// Color
 		mSwapchainBuffers[i].views[0] =
 			mDevice.createImageView(
 				vk::ImageViewCreateInfo(
 					vk::ImageViewCreateFlags(),
-					swapchainImages[i],
+					mSwapchainBuffers[i].image,
 					vk::ImageViewType::e2D,
 					mSurfaceColorFormat,
 					vk::ComponentMapping(),
@@ -468,7 +913,7 @@ void Renderer::createRenderPass()
 			vk::AttachmentLoadOp::eDontCare,
 			vk::AttachmentStoreOp::eDontCare,
 			vk::ImageLayout::eUndefined,
-			vk::ImageLayout::ePresentSrcKHR
+			mHeadless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR
 		),
 		vk::AttachmentDescription(
 			vk::AttachmentDescriptionFlags(),
@@ -545,18 +990,33 @@ void Renderer::createRenderPass()
 
 void Renderer::createSynchronization()
 {
-	// Semaphore used to ensures that image presentation is complete before starting to submit again
-	mPresentCompleteSemaphore = mDevice.createSemaphore(vk::SemaphoreCreateInfo());
+	mFrames.resize(std::max(mDesc.framesInFlight, 1u));
+
+	for (FrameData& frame : mFrames)
+	{
+		// Semaphore used to ensures that image presentation is complete before starting to submit again
+		frame.presentCompleteSemaphore = mDevice.createSemaphore(vk::SemaphoreCreateInfo());
 
-	// Semaphore used to ensures that all commands submitted have been finished before submitting the image to the queue
-	mRenderCompleteSemaphore = mDevice.createSemaphore(vk::SemaphoreCreateInfo());
+		// Semaphore used to ensures that all commands submitted have been finished before submitting the image to the queue
+		frame.renderCompleteSemaphore = mDevice.createSemaphore(vk::SemaphoreCreateInfo());
 
-	// Fence for command buffer completion
-	mWaitFences.resize(mSwapchainBuffers.size());
+		// Fence for command buffer completion, signaled so the first wait on this frame returns immediately
+		frame.waitFence = mDevice.createFence(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled));
+	}
 
-	for (size_t i = 0; i < mWaitFences.size(); i++)
+	// Timestamps are optional, queues that don't support them report 0 valid bits
+	uint32_t validBits = mPhysicalDevice.getQueueFamilyProperties()[mQueueFamilyIndex].timestampValidBits;
+	mTimestampPeriod = mPhysicalDevice.getProperties().limits.timestampPeriod;
+	if (validBits > 0 && mTimestampPeriod > 0.0f)
 	{
-		mWaitFences[i] = mDevice.createFence(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled));
+		mTimestampMask = validBits >= 64 ? ~0ULL : (1ULL << validBits) - 1;
+		mTimestampQueryPool = mDevice.createQueryPool(
+			vk::QueryPoolCreateInfo(
+				vk::QueryPoolCreateFlags(),
+				vk::QueryType::eTimestamp,
+				static_cast<uint32_t>(mFrames.size() * 2)
+			)
+		);
 	}
 }
 
@@ -570,7 +1030,7 @@ void Renderer::initializeResources()
 	std::vector<vk::DescriptorPoolSize> descriptorPoolSizes =
 	{
 		vk::DescriptorPoolSize(
-			vk::DescriptorType::eUniformBuffer,
+			vk::DescriptorType::eUniformBufferDynamic,
 			1
 		)
 	};
@@ -585,12 +1045,12 @@ void Renderer::initializeResources()
 	);
 
 	//Descriptor Set Layout
-	// Binding 0: Uniform buffer (Vertex shader)
+	// Binding 0: Uniform buffer (Vertex shader), offset into the uniform ring at bind time
 	std::vector<vk::DescriptorSetLayoutBinding> descriptorSetLayoutBindings =
 	{
 		vk::DescriptorSetLayoutBinding(
 			0,
-			vk::DescriptorType::eUniformBuffer,
+			vk::DescriptorType::eUniformBufferDynamic,
 			1,
 			vk::ShaderStageFlagBits::eVertex,
 			nullptr
@@ -632,7 +1092,6 @@ void Renderer::initializeResources()
 	mIndices.count = 3;
 	uint32_t indexBufferSize = mIndices.count * sizeof(uint32_t);
 
-	void *data;
 	// Static data like vertex and index buffer should be stored on the device memory 
 	// for optimal (and fastest) access by the GPU
 	//
@@ -645,7 +1104,7 @@ void Renderer::initializeResources()
 	// - Use the device local buffers for rendering
 
 	struct StagingBuffer {
-		vk::DeviceMemory memory;
+		DeviceAllocation memory;
 		vk::Buffer buffer;
 	};
 
@@ -669,19 +1128,12 @@ void Renderer::initializeResources()
 	auto memReqs = mDevice.getBufferMemoryRequirements(stagingBuffers.vertices.buffer);
 
 	// Request a host visible memory type that can be used to copy our data do
-	// Also request it to be coherent, so that writes are visible to the GPU right after unmapping the buffer
-	stagingBuffers.vertices.memory = mDevice.allocateMemory(
-		vk::MemoryAllocateInfo(
-			memReqs.size,
-			getMemoryTypeIndex(mPhysicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent)
-		)
-	);
+	// Also request it to be coherent, so that writes are visible to the GPU without a flush
+	stagingBuffers.vertices.memory = mAllocator.allocate(memReqs, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
-	// Map and copy
-	data = mDevice.mapMemory(stagingBuffers.vertices.memory, 0, memReqs.size, vk::MemoryMapFlags());
-	memcpy(data, mVertexBufferData, vertexBufferSize);
-	mDevice.unmapMemory(stagingBuffers.vertices.memory);
-	mDevice.bindBufferMemory(stagingBuffers.vertices.buffer, stagingBuffers.vertices.memory, 0);
+	// Host visible blocks are already mapped, so just copy
+	memcpy(stagingBuffers.vertices.memory.mapped, mVertexBufferData, vertexBufferSize);
+	mDevice.bindBufferMemory(stagingBuffers.vertices.buffer, stagingBuffers.vertices.memory.memory, stagingBuffers.vertices.memory.offset);
 
 	// Create a device local buffer to which the (host local) vertex data will be copied and which will be used for rendering
 	mVertices.buffer = mDevice.createBuffer(
@@ -697,14 +1149,9 @@ void Renderer::initializeResources()
 
 	memReqs = mDevice.getBufferMemoryRequirements(mVertices.buffer);
 
-	mVertices.memory = mDevice.allocateMemory(
-		vk::MemoryAllocateInfo(
-			memReqs.size,
-			getMemoryTypeIndex(mPhysicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal)
-		)
-	);
+	mVertices.memory = mAllocator.allocate(memReqs, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
-	mDevice.bindBufferMemory(mVertices.buffer, mVertices.memory, 0);
+	mDevice.bindBufferMemory(mVertices.buffer, mVertices.memory.memory, mVertices.memory.offset);
 
 	// Index buffer
 	// Copy index data to a buffer visible to the host (staging buffer)
@@ -719,17 +1166,10 @@ void Renderer::initializeResources()
 		)
 	);
 	memReqs = mDevice.getBufferMemoryRequirements(stagingBuffers.indices.buffer);
-	stagingBuffers.indices.memory = mDevice.allocateMemory(
-		vk::MemoryAllocateInfo(
-			memReqs.size,
-			getMemoryTypeIndex(mPhysicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent)
-		)
-	);
+	stagingBuffers.indices.memory = mAllocator.allocate(memReqs, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
-	data = mDevice.mapMemory(stagingBuffers.indices.memory, 0, indexBufferSize, vk::MemoryMapFlags());
-	memcpy(data, mIndexBufferData, indexBufferSize);
-	mDevice.unmapMemory(stagingBuffers.indices.memory);
-	mDevice.bindBufferMemory(stagingBuffers.indices.buffer, stagingBuffers.indices.memory, 0);
+	memcpy(stagingBuffers.indices.memory.mapped, mIndexBufferData, indexBufferSize);
+	mDevice.bindBufferMemory(stagingBuffers.indices.buffer, stagingBuffers.indices.memory.memory, stagingBuffers.indices.memory.offset);
 
 	// Create destination buffer with device only visibility
 	mIndices.buffer = mDevice.createBuffer(
@@ -744,15 +1184,9 @@ void Renderer::initializeResources()
 	);
 
 	memReqs = mDevice.getBufferMemoryRequirements(mIndices.buffer);
-	mIndices.memory = mDevice.allocateMemory(
-		vk::MemoryAllocateInfo(
-			memReqs.size,
-			getMemoryTypeIndex(mPhysicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal
-			)
-		)
-	);
+	mIndices.memory = mAllocator.allocate(memReqs, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
-	mDevice.bindBufferMemory(mIndices.buffer, mIndices.memory, 0);
+	mDevice.bindBufferMemory(mIndices.buffer, mIndices.memory.memory, mIndices.memory.offset);
 
 	auto getCommandBuffer = [&](bool begin)
 	{
@@ -820,15 +1254,16 @@ void Renderer::initializeResources()
 	// Destroy staging buffers
 	// Note: Staging buffer must not be deleted before the copies have been submitted and executed
 	mDevice.destroyBuffer(stagingBuffers.vertices.buffer);
-	mDevice.freeMemory(stagingBuffers.vertices.memory);
+	mAllocator.free(stagingBuffers.vertices.memory);
 	mDevice.destroyBuffer(stagingBuffers.indices.buffer);
-	mDevice.freeMemory(stagingBuffers.indices.memory);
+	mAllocator.free(stagingBuffers.indices.memory);
 
 
 	// Vertex input binding
-	mVertices.inputBinding.binding = 0;
-	mVertices.inputBinding.stride = sizeof(Vertex);
-	mVertices.inputBinding.inputRate = vk::VertexInputRate::eVertex;
+	mVertices.inputBindings.resize(1);
+	mVertices.inputBindings[0].binding = 0;
+	mVertices.inputBindings[0].stride = sizeof(Vertex);
+	mVertices.inputBindings[0].inputRate = vk::VertexInputRate::eVertex;
 
 	// Inpute attribute binding describe shader attribute locations and memory layouts
 	// These match the following shader layout (see assets/shaders/triangle.vert):
@@ -846,64 +1281,88 @@ void Renderer::initializeResources()
 	mVertices.inputAttributes[1].format = vk::Format::eR32G32B32Sfloat;
 	mVertices.inputAttributes[1].offset = offsetof(Vertex, color);
 
+	if (mDesc.instanceCount > 0)
+	{
+		// Binding 1 steps once per instance, InstanceData's matrix is a column per location (see assets/shaders/triangle.instanced.vert):
+		//	layout (location = 2) in mat4 inModelViewProjection;
+		mVertices.inputBindings.push_back(vk::VertexInputBindingDescription(1, sizeof(InstanceData), vk::VertexInputRate::eInstance));
+		for (uint32_t column = 0; column < 4; ++column)
+		{
+			mVertices.inputAttributes.push_back(
+				vk::VertexInputAttributeDescription(2 + column, 1, vk::Format::eR32G32B32A32Sfloat, column * 4 * sizeof(float)));
+		}
+	}
+
 	// Assign to the vertex input state used for pipeline creation
 	mVertices.inputState.flags = vk::PipelineVertexInputStateCreateFlags();
-	mVertices.inputState.vertexBindingDescriptionCount = 1;
-	mVertices.inputState.pVertexBindingDescriptions = &mVertices.inputBinding;
+	mVertices.inputState.vertexBindingDescriptionCount = static_cast<uint32_t>(mVertices.inputBindings.size());
+	mVertices.inputState.pVertexBindingDescriptions = mVertices.inputBindings.data();
 	mVertices.inputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(mVertices.inputAttributes.size());
 	mVertices.inputState.pVertexAttributeDescriptions = mVertices.inputAttributes.data();
 
 	// Prepare and initialize a uniform buffer block containing shader uniforms
 	// Single uniforms like in OpenGL are no longer present in Vulkan. All Shader uniforms are passed via uniform buffer blocks
 
-	// Vertex shader uniform buffer block
-	vk::MemoryAllocateInfo allocInfo = {};
-	allocInfo.pNext = nullptr;
-	allocInfo.allocationSize = 0;
-	allocInfo.memoryTypeIndex = 0;
+	// Every frame in flight gets its own region of the ring, so the CPU never writes data the GPU may still be reading.
+	// Each region starts with a uboVS per draw. Drawing instanced, there's one uboVS followed by the instance stream
+	// and the ring doubles as a vertex buffer
+	mDrawCount = mDesc.instanceCount > 0 ? mDesc.instanceCount : std::max(mDesc.drawCount, 1u);
+	mUniformRing.alignment = mPhysicalDevice.getProperties().limits.minUniformBufferOffsetAlignment;
+	mDrawStride = (sizeof(uboVS) + mUniformRing.alignment - 1) & ~(mUniformRing.alignment - 1);
+	mInstanceOffset = mDrawStride;
+	vk::DeviceSize sceneBytes = mDesc.instanceCount > 0 ? mInstanceOffset + sizeof(InstanceData) * mDesc.instanceCount : mDrawStride * mDrawCount;
+	vk::DeviceSize uniformBytes = std::max<vk::DeviceSize>(mDesc.uniformBytesPerFrame, sceneBytes);
+	mUniformRing.frameSize = (uniformBytes + mUniformRing.alignment - 1) & ~(mUniformRing.alignment - 1);
+
+	vk::BufferUsageFlags ringUsage = vk::BufferUsageFlagBits::eUniformBuffer;
+	if (mDesc.instanceCount > 0)
+	{
+		ringUsage |= vk::BufferUsageFlagBits::eVertexBuffer;
+	}
 
-	// Create a new buffer
-	mUniformDataVS.buffer = mDevice.createBuffer(
+	mUniformRing.buffer = mDevice.createBuffer(
 		vk::BufferCreateInfo(
 			vk::BufferCreateFlags(),
-			sizeof(uboVS),
-			vk::BufferUsageFlagBits::eUniformBuffer
+			mUniformRing.frameSize * mFrames.size(),
+			ringUsage
 		)
 	);
-	// Get memory requirements including size, alignment and memory type 
-	memReqs = mDevice.getBufferMemoryRequirements(mUniformDataVS.buffer);
-	allocInfo.allocationSize = memReqs.size;
-	// Get the memory type index that supports host visible memory access
-	// Most implementations offer multiple memory types and selecting the correct one to allocate memory from is crucial
-	// We also want the buffer to be host coherent so we don't have to flush (or sync after every update.
-	// Note: This may affect performance so you might not want to do this in a real world application that updates buffers on a regular base
-	allocInfo.memoryTypeIndex = getMemoryTypeIndex(mPhysicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-	// Allocate memory for the uniform buffer
-	mUniformDataVS.memory = mDevice.allocateMemory(allocInfo);
-	// Bind memory to buffer
-	mDevice.bindBufferMemory(mUniformDataVS.buffer, mUniformDataVS.memory, 0);
-
-	// Store information in the uniform's descriptor that is used by the descriptor set
-	mUniformDataVS.descriptor.buffer = mUniformDataVS.buffer;
-	mUniformDataVS.descriptor.offset = 0;
-	mUniformDataVS.descriptor.range = sizeof(uboVS);
+	memReqs = mDevice.getBufferMemoryRequirements(mUniformRing.buffer);
+
+	// Host coherent memory lets us keep the ring mapped for the lifetime of the app without any flushes
+	mUniformRing.memory = mAllocator.allocate(memReqs, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+	mDevice.bindBufferMemory(mUniformRing.buffer, mUniformRing.memory.memory, mUniformRing.memory.offset);
+	mUniformRing.mapped = mUniformRing.memory.mapped;
+	resetUniformRing(0);
+
+	// The descriptor covers one uboVS, dynamic offsets select where it lives in the ring
+	mUniformRing.descriptor.buffer = mUniformRing.buffer;
+	mUniformRing.descriptor.offset = 0;
+	mUniformRing.descriptor.range = sizeof(uboVS);
 
 	// Update Uniforms
 	float zoom = -2.5f;
 
 	// Update matrices
-	uboVS.projectionMatrix = Matrix4::perspective(45.0f, (float)mViewport.width / (float)mViewport.height, 0.01f, 1024.0f);
+	mProjectionMatrix = Matrix4::perspective(45.0f, (float)mViewport.width / (float)mViewport.height, 0.01f, 1024.0f);
 
-	uboVS.viewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom));
+	mViewMatrix = Matrix4::translation(Vector3(0.0f, 0.0f, zoom));
 
-	uboVS.modelMatrix = Matrix4::identity();
-
-	// Map uniform buffer and update it
-	void *pData;
-	pData = mDevice.mapMemory(mUniformDataVS.memory, 0, sizeof(uboVS));
-	memcpy(pData, &uboVS, sizeof(uboVS));
-	mDevice.unmapMemory(mUniformDataVS.memory);
+	mModelMatrix = Matrix4::identity();
 
+	// One instanced draw per recording job instead of a draw per object
+	if (mDesc.instanceCount > 0)
+	{
+		createInstancePlacements();
+	}
+	else
+	{
+		mDrawPlacements.resize(mDrawCount);
+		for (uint32_t draw = 0; draw < mDrawCount; ++draw)
+		{
+			mDrawPlacements.set(draw, getGridPlacement(draw, mDrawCount));
+		}
+	}
 
 	std::vector<vk::WriteDescriptorSet> descriptorWrites =
 	{
@@ -912,9 +1371,9 @@ void Renderer::initializeResources()
 			0,
 			0,
 			1,
-			vk::DescriptorType::eUniformBuffer,
+			vk::DescriptorType::eUniformBufferDynamic,
 			nullptr,
-			&mUniformDataVS.descriptor,
+			&mUniformRing.descriptor,
 			nullptr
 		)
 	};
@@ -929,39 +1388,58 @@ void Renderer::initializeResources()
 
 	// Create Graphics Pipeline
 
-	std::vector<char> vertShaderCode = readFile("assets/shaders/triangle.vert.spv");
-	std::vector<char> fragShaderCode = readFile("assets/shaders/triangle.frag.spv");
+	createPipelineCache();
+	createPipeline();
 
-	mVertModule = mDevice.createShaderModule(
-		vk::ShaderModuleCreateInfo(
-			vk::ShaderModuleCreateFlags(),
-			vertShaderCode.size(),
-			(uint32_t*)vertShaderCode.data()
-		)
-	);
+	if (mDesc.shaderHotReload)
+	{
+		watchShaders(mDesc.instanceCount > 0 ? std::vector<std::string>{ "triangle", "triangle.instanced" } : std::vector<std::string>{ "triangle" }, "spv");
+	}
+}
 
-	mFragModule = mDevice.createShaderModule(
+void Renderer::createPipeline()
+{
+	std::vector<char> vertShaderCode = readShader(mDesc.instanceCount > 0 ? "assets/shaders/triangle.instanced.vert.spv" : "assets/shaders/triangle.vert.spv");
+	std::vector<char> fragShaderCode = readShader("assets/shaders/triangle.frag.spv");
+
+	// Built into locals and only handed to the members once the pipeline exists, so a failed reload leaks nothing
+	vk::ShaderModule vertModule = mDevice.createShaderModule(
 		vk::ShaderModuleCreateInfo(
 			vk::ShaderModuleCreateFlags(),
-			fragShaderCode.size(),
-			(uint32_t*)fragShaderCode.data()
+			vertShaderCode.size(),
+			(uint32_t*)vertShaderCode.data()
 		)
 	);
 
-	mPipelineCache = mDevice.createPipelineCache(vk::PipelineCacheCreateInfo());
+	vk::ShaderModule fragModule;
+	try
+	{
+		fragModule = mDevice.createShaderModule(
+			vk::ShaderModuleCreateInfo(
+				vk::ShaderModuleCreateFlags(),
+				fragShaderCode.size(),
+				(uint32_t*)fragShaderCode.data()
+			)
+		);
+	}
+	catch (...)
+	{
+		mDevice.destroyShaderModule(vertModule);
+		throw;
+	}
 
 	std::vector<vk::PipelineShaderStageCreateInfo> pipelineShaderStages = {
 		vk::PipelineShaderStageCreateInfo(
 			vk::PipelineShaderStageCreateFlags(),
 			vk::ShaderStageFlagBits::eVertex,
-			mVertModule,
+			vertModule,
 			"main",
 			nullptr
 		),
 		vk::PipelineShaderStageCreateInfo(
 			vk::PipelineShaderStageCreateFlags(),
 			vk::ShaderStageFlagBits::eFragment,
-			mFragModule,
+			fragModule,
 			"main",
 			nullptr
 		)
@@ -1051,37 +1529,105 @@ void Renderer::initializeResources()
 		dynamicStates.data()
 	);
 
-	mPipeline = mDevice.createGraphicsPipeline(
-		mPipelineCache,
-		vk::GraphicsPipelineCreateInfo(
-			vk::PipelineCreateFlags(),
-			static_cast<uint32_t>(pipelineShaderStages.size()),
-			pipelineShaderStages.data(),
-			&pvi,
-			&pia,
-			nullptr,
-			&pv,
-			&pr,
-			&pm,
-			&pds,
-			&pbs,
-			&pdy,
-			mPipelineLayout,
-			mRenderPass,
-			0
-		)
-	);
+	vk::Pipeline pipeline;
+	try
+	{
+		pipeline = mDevice.createGraphicsPipeline(
+			mPipelineCache,
+			vk::GraphicsPipelineCreateInfo(
+				vk::PipelineCreateFlags(),
+				static_cast<uint32_t>(pipelineShaderStages.size()),
+				pipelineShaderStages.data(),
+				&pvi,
+				&pia,
+				nullptr,
+				&pv,
+				&pr,
+				&pm,
+				&pds,
+				&pbs,
+				&pdy,
+				mPipelineLayout,
+				mRenderPass,
+				0
+			)
+		);
+	}
+	catch (...)
+	{
+		mDevice.destroyShaderModule(vertModule);
+		mDevice.destroyShaderModule(fragModule);
+		throw;
+	}
+
+	mVertModule = vertModule;
+	mFragModule = fragModule;
+	mPipeline = pipeline;
+}
+
+void Renderer::reloadShaders()
+{
+	// Only the programs the pipeline is built from are watched
+	std::vector<std::string> programs = mShaderWatcher.takeChangedPrograms();
+	if (programs.empty())
+	{
+		return;
+	}
+
+	ProfileScope scope(mProfiler, "Shader Reload");
+
+	// Frames still in flight use the old pipeline, it's destroyed once they've finished rather than waiting on the GPU
+	RetiredPipeline retired;
+	retired.pipeline = mPipeline;
+	retired.vertModule = mVertModule;
+	retired.fragModule = mFragModule;
+	retired.submitSerial = mSubmitSerial;
+
+	try
+	{
+		createPipeline();
+	}
+	catch (const std::exception& e)
+	{
+		// createPipeline only replaces the members once everything it built succeeded
+		std::cout << "Failed to reload shaders, keeping the running pipeline: " << e.what() << "\n";
+		return;
+	}
+	mRetiredPipelines.push_back(retired);
+
+	// Every command buffer binds the old pipeline, each is recorded again before its next submit
+	std::fill(mCommandBufferDirty.begin(), mCommandBufferDirty.end(), true);
+}
+
+void Renderer::destroyRetiredPipelines(bool all)
+{
+	for (size_t i = 0; i < mRetiredPipelines.size();)
+	{
+		RetiredPipeline& retired = mRetiredPipelines[i];
+		if (!all && retired.submitSerial > mCompletedSerial)
+		{
+			++i;
+			continue;
+		}
+
+		mDevice.destroyPipeline(retired.pipeline);
+		mDevice.destroyShaderModule(retired.vertModule);
+		mDevice.destroyShaderModule(retired.fragModule);
+		mRetiredPipelines.erase(mRetiredPipelines.begin() + i);
+	}
 }
 
 void Renderer::destroyResources()
 {
+	mShaderWatcher.stop();
+
 	// Vertices
-	mDevice.freeMemory(mVertices.memory);
 	mDevice.destroyBuffer(mVertices.buffer);
+	mAllocator.free(mVertices.memory);
 
 	// Index buffer
-	mDevice.freeMemory(mIndices.memory);
 	mDevice.destroyBuffer(mIndices.buffer);
+	mAllocator.free(mIndices.memory);
 
 	// Shader Module
 	mDevice.destroyShaderModule(mVertModule);
@@ -1091,8 +1637,10 @@ void Renderer::destroyResources()
 	mDevice.destroyRenderPass(mRenderPass);
 
 	// Graphics Pipeline
+	savePipelineCache();
 	mDevice.destroyPipelineCache(mPipelineCache);
 	mDevice.destroyPipeline(mPipeline);
+	destroyRetiredPipelines(true);
 	mDevice.destroyPipelineLayout(mPipelineLayout);
 
 	// Descriptor Pool
@@ -1102,20 +1650,29 @@ void Renderer::destroyResources()
 		mDevice.destroyDescriptorSetLayout(dsl);
 	}
 
-	// Uniform block object
-	mDevice.freeMemory(mUniformDataVS.memory);
-	mDevice.destroyBuffer(mUniformDataVS.buffer);
+	// Uniform ring, its block is unmapped by the allocator
+	mDevice.destroyBuffer(mUniformRing.buffer);
+	mAllocator.free(mUniformRing.memory);
 
-	// Destroy Framebuffers, Image Views
+	// Destroy Swapchain, Framebuffers, Image Views
 	destroyFrameBuffer();
-	mDevice.destroySwapchainKHR(mSwapchain);
 
 	// Sync
-	mDevice.destroySemaphore(mPresentCompleteSemaphore);
-	mDevice.destroySemaphore(mRenderCompleteSemaphore);
-	for (vk::Fence& f : mWaitFences)
+	for (FrameData& frame : mFrames)
+	{
+		mDevice.destroySemaphore(frame.presentCompleteSemaphore);
+		mDevice.destroySemaphore(frame.renderCompleteSemaphore);
+		mDevice.destroyFence(frame.waitFence);
+
+		if (frame.readbackBuffer)
+		{
+			mDevice.destroyBuffer(frame.readbackBuffer);
+			mAllocator.free(frame.readbackMemory);
+		}
+	}
+	if (mTimestampQueryPool)
 	{
-		mDevice.destroyFence(f);
+		mDevice.destroyQueryPool(mTimestampQueryPool);
 	}
 
 }
@@ -1126,12 +1683,37 @@ void Renderer::createCommands()
 		vk::CommandBufferAllocateInfo(
 			mCommandPool,
 			vk::CommandBufferLevel::ePrimary,
-			static_cast<uint32_t>(mSwapchainBuffers.size())
+			static_cast<uint32_t>(mFrames.size() * mSwapchainBuffers.size())
 		)
 	);
+
+	mSecondaryCommandBuffers.resize(mJobCommandPools.size());
+	for (size_t job = 0; job < mJobCommandPools.size(); ++job)
+	{
+		mSecondaryCommandBuffers[job] = mDevice.allocateCommandBuffers(
+			vk::CommandBufferAllocateInfo(
+				mJobCommandPools[job],
+				vk::CommandBufferLevel::eSecondary,
+				static_cast<uint32_t>(mCommandBuffers.size())
+			)
+		);
+	}
+
+	mCommandBufferDirty.assign(mCommandBuffers.size(), true);
 }
 
 void Renderer::setupCommands()
+{
+	// Everything is recorded up front, after that only dirty command buffers are recorded again as they come up
+	std::vector<size_t> commandBuffers(mCommandBuffers.size());
+	for (size_t i = 0; i < commandBuffers.size(); ++i)
+	{
+		commandBuffers[i] = i;
+	}
+	recordCommands(commandBuffers);
+}
+
+void Renderer::recordCommands(const std::vector<size_t>& commandBuffers)
 {
 	std::vector<vk::ClearValue> clearValues =
 	{
@@ -1140,97 +1722,269 @@ void Renderer::setupCommands()
 		vk::ClearDepthStencilValue(1.0f, 0)
 	};
 
-	for (size_t i = 0; i < mCommandBuffers.size(); ++i)
+	bool parallel = !mJobCommandPools.empty();
+	uint32_t jobCount = std::min(static_cast<uint32_t>(mJobCommandPools.size()), mDrawCount);
+
+	if (parallel)
 	{
+		// Each job records its range of draws for every primary, so a job's pool is only ever used by one thread at a time.
+		// There are never more jobs than draws, so no job records an empty secondary
+		mRecordingThreads.parallelFor(jobCount, [&](unsigned job)
+		{
+			uint32_t firstDraw = mDrawCount * job / jobCount;
+			uint32_t lastDraw = mDrawCount * (job + 1) / jobCount;
+
+			for (size_t i : commandBuffers)
+			{
+				size_t frame = i / mSwapchainBuffers.size();
+				size_t image = i % mSwapchainBuffers.size();
+
+				vk::CommandBufferInheritanceInfo inheritance(mRenderPass, 0, mSwapchainBuffers[image].frameBuffer);
+
+				vk::CommandBuffer& cmd = mSecondaryCommandBuffers[job][i];
+				cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eRenderPassContinue, &inheritance));
+				recordDraws(cmd, frame, firstDraw, lastDraw - firstDraw);
+				cmd.end();
+			}
+		});
+	}
+
+	std::vector<vk::CommandBuffer> secondaries(jobCount);
+
+	for (size_t i : commandBuffers)
+	{
+		size_t frame = i / mSwapchainBuffers.size();
+		size_t image = i % mSwapchainBuffers.size();
+
 		vk::CommandBuffer& cmd = mCommandBuffers[i];
 		cmd.reset(vk::CommandBufferResetFlagBits::eReleaseResources);
 		cmd.begin(vk::CommandBufferBeginInfo());
+
+		// Queries have to be reset before each reuse, outside of a render pass
+		uint32_t firstQuery = static_cast<uint32_t>(frame * 2);
+		if (mTimestampQueryPool)
+		{
+			cmd.resetQueryPool(mTimestampQueryPool, firstQuery, 2);
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, mTimestampQueryPool, firstQuery);
+		}
+
 		cmd.beginRenderPass(
 			vk::RenderPassBeginInfo(
 				mRenderPass,
-				mSwapchainBuffers[i].frameBuffer,
+				mSwapchainBuffers[image].frameBuffer,
 				mRenderArea,
 				static_cast<uint32_t>(clearValues.size()),
 				clearValues.data()),
-			vk::SubpassContents::eInline);
+			parallel ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline);
+
+		if (parallel)
+		{
+			for (size_t job = 0; job < secondaries.size(); ++job)
+			{
+				secondaries[job] = mSecondaryCommandBuffers[job][i];
+			}
+			cmd.executeCommands(secondaries);
+		}
+		else
+		{
+			recordDraws(cmd, frame, 0, mDrawCount);
+		}
+
+		cmd.endRenderPass();
 
-		cmd.setViewport(0, 1, &mViewport);
+		// The end timestamp goes before the readback copy so GPU time is just the render pass
+		if (mTimestampQueryPool)
+		{
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, mTimestampQueryPool, firstQuery + 1);
+		}
 
-		cmd.setScissor(0, 1, &mRenderArea);
+		if (hasReadback(frame))
+		{
+			recordReadback(cmd, frame, image);
+		}
 
-		// Bind Descriptor Sets, these are attribute/uniform "descriptions"
-		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, mPipeline);
+		cmd.end();
 
+		mCommandBufferDirty[i] = false;
+	}
+}
+
+void Renderer::recordDraws(vk::CommandBuffer& cmd, size_t frame, uint32_t firstDraw, uint32_t drawCount)
+{
+	// Secondary command buffers don't inherit any state, so every range binds everything it uses
+	cmd.setViewport(0, 1, &mViewport);
+
+	cmd.setScissor(0, 1, &mRenderArea);
+
+	// Bind Descriptor Sets, these are attribute/uniform "descriptions"
+	cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, mPipeline);
+
+	vk::DeviceSize offsets = 0;
+	cmd.bindVertexBuffers(0, 1, &mVertices.buffer, &offsets);
+	cmd.bindIndexBuffer(mIndices.buffer, 0, vk::IndexType::eUint32);
+
+	// The draws' uboVS copies are the first allocation render() makes in each frame's region of the uniform ring
+	uint32_t uniformOffset = static_cast<uint32_t>(frame * mUniformRing.frameSize);
+
+	if (mDesc.instanceCount > 0)
+	{
 		cmd.bindDescriptorSets(
 			vk::PipelineBindPoint::eGraphics,
 			mPipelineLayout,
 			0,
 			mDescriptorSets,
-			nullptr
+			uniformOffset
 		);
 
-		vk::DeviceSize offsets = 0;
-		cmd.bindVertexBuffers(0, 1, &mVertices.buffer, &offsets);
-		cmd.bindIndexBuffer(mIndices.buffer, 0, vk::IndexType::eUint32);
-		cmd.drawIndexed(mIndices.count, 1, 0, 0, 1);
-		cmd.endRenderPass();
-		cmd.end();
+		// This frame's instance stream, firstInstance offsets the range into it
+		vk::DeviceSize instanceOffset = frame * mUniformRing.frameSize + mInstanceOffset;
+		cmd.bindVertexBuffers(1, 1, &mUniformRing.buffer, &instanceOffset);
+		cmd.drawIndexed(mIndices.count, drawCount, 0, 0, firstDraw);
+		return;
+	}
+
+	// Each draw binds its own uboVS through the dynamic offset
+	for (uint32_t draw = firstDraw; draw < firstDraw + drawCount; ++draw)
+	{
+		cmd.bindDescriptorSets(
+			vk::PipelineBindPoint::eGraphics,
+			mPipelineLayout,
+			0,
+			mDescriptorSets,
+			uniformOffset + static_cast<uint32_t>(mDrawStride * draw)
+		);
+		cmd.drawIndexed(mIndices.count, 1, 0, 0, 0);
 	}
 }
 
 void Renderer::render()
 {
-	// Framelimit set to 60 fps
-	tEnd = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::milli>(tEnd - tStart).count();
-	if (time < (1000.0f / 60.0f))
+	mProfiler.nextFrame();
+
+	// Sleep until the frame pacer says the next frame is due, rather than spinning on the clock
+	float time;
 	{
-		return;
+		ProfileScope scope(mProfiler, "Frame Pacing");
+		time = mFramePacer.waitForNextFrame();
 	}
-	tStart = std::chrono::high_resolution_clock::now();
 
-	// Swap backbuffers
+	// Swap in edited shaders before this frame's command buffer is recorded or submitted
+	reloadShaders();
+
+	FrameData& frame = mFrames[mFrameIndex];
 	vk::Result result;
+	uint32_t latencyTag = 0;
 
-	result = mDevice.acquireNextImageKHR(mSwapchain, UINT64_MAX, mPresentCompleteSemaphore, nullptr, &mCurrentBuffer);
-	if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
 	{
-		// Swapchain lost, we'll try again next poll
-		resize(mSurfaceSize.width, mSurfaceSize.height);
-		return;
+		ProfileScope scope(mProfiler, "Acquire");
+
+		// Wait until the GPU is done with the last submission that used this frame's resources
+		mDevice.waitForFences(1, &frame.waitFence, VK_TRUE, UINT64_MAX);
+		readTimestamps(mFrameIndex);
+		deliverReadback(mFrameIndex);
+
+		// Anything retired before this frame's last submission is no longer in use
+		mCompletedSerial = std::max(mCompletedSerial, frame.submitSerial);
+		destroyRetiredSurfaces(false);
+		destroyRetiredPipelines(false);
+
+		// Swap backbuffers
+		if (mHeadless)
+		{
+			// Each frame in flight owns the offscreen image with the same index
+			mCurrentBuffer = mFrameIndex;
+		}
+		else
+		{
+			result = mDevice.acquireNextImageKHR(mSwapchain, UINT64_MAX, frame.presentCompleteSemaphore, nullptr, &mCurrentBuffer);
+			if (result == vk::Result::eErrorOutOfDateKHR)
+			{
+				// Swapchain lost, we'll try again next poll
+				resize(mSurfaceSize.width, mSurfaceSize.height);
+				return;
+
+			}
+			if (result == vk::Result::eErrorDeviceLost)
+			{
+				// driver lost, we'll crash in this case:
+				exit(1);
+			}
+		}
+	}
 
+	// Only reset once we know we'll submit work that signals it again
+	mDevice.resetFences(1, &frame.waitFence);
+
+	// Readback buffers follow the surface size, replacing one dirties the command buffers that copy into it
+	if (mReadbackCallback && mReadbackSupported && frame.readbackExtent != mSurfaceSize)
+	{
+		createReadbackBuffer(mFrameIndex);
 	}
-	if (result == vk::Result::eErrorDeviceLost)
+
+	// This frame's command buffers aren't pending anymore, so one invalidated by a resize can be recorded again now
+	size_t commandIndex = mFrameIndex * mSwapchainBuffers.size() + mCurrentBuffer;
+	if (mCommandBufferDirty[commandIndex])
 	{
-		// driver lost, we'll crash in this case:
-		exit(1);
+		ProfileScope scope(mProfiler, "Record");
+		recordCommands(std::vector<size_t>(1, commandIndex));
 	}
 
 	// Update Uniforms
-	mElapsedTime += 0.001f * time;
-	mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
-	uboVS.modelMatrix = Matrix4::rotationY(mElapsedTime);
-
-	void *pData;
-	pData = mDevice.mapMemory(mUniformDataVS.memory, 0, sizeof(uboVS));
-	memcpy(pData, &uboVS, sizeof(uboVS));
-	mDevice.unmapMemory(mUniformDataVS.memory);
-
-	// Wait for Fences
-	mDevice.waitForFences(1, &mWaitFences[mCurrentBuffer], VK_TRUE, UINT64_MAX);
-	mDevice.resetFences(1, &mWaitFences[mCurrentBuffer]);
-
-	vk::SubmitInfo submitInfo;
-	vk::PipelineStageFlags waitDstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-	submitInfo
-		.setWaitSemaphoreCount(1)
-		.setPWaitSemaphores(&mPresentCompleteSemaphore)
-		.setPWaitDstStageMask(&waitDstStageMask)
-		.setCommandBufferCount(1)
-		.setPCommandBuffers(&mCommandBuffers[mCurrentBuffer])
-		.setSignalSemaphoreCount(1)
-		.setPSignalSemaphores(&mRenderCompleteSemaphore);
-	result = mQueue.submit(1, &submitInfo, mWaitFences[mCurrentBuffer]);
+	{
+		ProfileScope scope(mProfiler, "Uniform Update");
+
+		mElapsedTime += 0.001f * time;
+		mElapsedTime = fmodf(mElapsedTime, 6.283185307179586f);
+		mModelMatrix = Matrix4::rotationY(mElapsedTime);
+		uboVS.modelViewProjection = mProjectionMatrix * mViewMatrix * mModelMatrix;
+
+		// This frame's state is sampled here, so it's the one that shows the input reported so far
+		if (mDesc.measureLatency && !mHeadless)
+		{
+			latencyTag = mLatency.tagFrame();
+		}
+
+		resetUniformRing(mFrameIndex);
+		if (mDesc.instanceCount > 0)
+		{
+			pushUniforms(&uboVS, sizeof(uboVS));
+
+			// Lands at mInstanceOffset, where the command buffers read it from
+			writeInstances(mUniformRing.mapped + allocateUniforms(sizeof(InstanceData) * mDesc.instanceCount));
+		}
+		else
+		{
+			// A uboVS per draw, mDrawStride apart where the command buffers' dynamic offsets point
+			concatenateTransforms(mProjectionMatrix * mViewMatrix, mDrawPlacements, mModelMatrix,
+				mUniformRing.mapped + allocateUniforms(mDrawStride * mDrawCount), static_cast<size_t>(mDrawStride));
+		}
+	}
+
+	{
+		ProfileScope scope(mProfiler, "Submit");
+
+		vk::CommandBuffer& cmd = mCommandBuffers[commandIndex];
+
+		// Headless frames have nothing to wait on or present, the fence alone tracks them
+		uint32_t semaphoreCount = mHeadless ? 0 : 1;
+
+		vk::SubmitInfo submitInfo;
+		vk::PipelineStageFlags waitDstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+		submitInfo
+			.setWaitSemaphoreCount(semaphoreCount)
+			.setPWaitSemaphores(&frame.presentCompleteSemaphore)
+			.setPWaitDstStageMask(&waitDstStageMask)
+			.setCommandBufferCount(1)
+			.setPCommandBuffers(&cmd)
+			.setSignalSemaphoreCount(semaphoreCount)
+			.setPSignalSemaphores(&frame.renderCompleteSemaphore);
+		result = mQueue.submit(1, &submitInfo, frame.waitFence);
+
+		frame.submitSerial = ++mSubmitSerial;
+		frame.profilerFrame = mProfiler.getFrameIndex();
+		frame.timestampsPending = mTimestampQueryPool ? true : false;
+		frame.readbackPending = hasReadback(mFrameIndex);
+	}
 
 	if (result == vk::Result::eErrorDeviceLost)
 	{
@@ -1238,16 +1992,44 @@ void Renderer::render()
 		exit(1);
 	}
 
-	result = mQueue.presentKHR(
-		vk::PresentInfoKHR(
+	if (mHeadless)
+	{
+		mFrameIndex = (mFrameIndex + 1) % static_cast<uint32_t>(mFrames.size());
+		return;
+	}
+
+	{
+		ProfileScope scope(mProfiler, "Present");
+
+		vk::PresentInfoKHR presentInfo(
 			1,
-			&mRenderCompleteSemaphore,
+			&frame.renderCompleteSemaphore,
 			1,
 			&mSwapchain,
 			&mCurrentBuffer,
 			nullptr
-		)
-	);
+		);
+
+		// The latency tag doubles as the present ID the display timing is reported under
+		vk::PresentTimeGOOGLE presentTime(latencyTag, 0);
+		vk::PresentTimesInfoGOOGLE presentTimes(1, &presentTime);
+		if (mGetPastPresentationTiming != nullptr && latencyTag != 0)
+		{
+			presentInfo.setPNext(&presentTimes);
+		}
+
+		FramePacer::Clock::time_point presentStart = FramePacer::Clock::now();
+		result = mQueue.presentKHR(presentInfo);
+		mFramePacer.onPresent(presentStart);
+
+		if (latencyTag != 0)
+		{
+			mLatency.onPresented(latencyTag, LatencyTracker::Clock::now());
+		}
+		readPresentationTimings();
+	}
+
+	mFrameIndex = (mFrameIndex + 1) % static_cast<uint32_t>(mFrames.size());
 
 	if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
 	{
@@ -1257,18 +2039,301 @@ void Renderer::render()
 	}
 }
 
+void Renderer::readPresentationTimings()
+{
+	if (mGetPastPresentationTiming == nullptr)
+	{
+		return;
+	}
+
+	// Only returns the presents the swapchain hasn't reported yet, in order
+	uint32_t count = 0;
+	VkSwapchainKHR swapchain = static_cast<VkSwapchainKHR>(mSwapchain);
+	if (mGetPastPresentationTiming(static_cast<VkDevice>(mDevice), swapchain, &count, nullptr) != VK_SUCCESS || count == 0)
+	{
+		return;
+	}
+
+	std::vector<VkPastPresentationTimingGOOGLE> timings(count);
+	mGetPastPresentationTiming(static_cast<VkDevice>(mDevice), swapchain, &count, timings.data());
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		// Nanoseconds of CLOCK_MONOTONIC, the clock steady_clock reads on Linux
+		std::chrono::nanoseconds displayed(timings[i].actualPresentTime);
+		mLatency.onDisplayed(timings[i].presentID, LatencyTracker::Clock::time_point(std::chrono::duration_cast<LatencyTracker::Clock::duration>(displayed)));
+	}
+}
+
 void Renderer::resize(unsigned width, unsigned height)
 {
-	mDevice.waitIdle();
-	destroyFrameBuffer();
+	// Frames in flight still use the old swapchain, framebuffers and depth buffer, so they're retired rather than destroyed.
+	// The depth format, render pass, pipeline and descriptors don't depend on the extent and stay as they are.
+	size_t imageCount = mSwapchainBuffers.size();
+	retireSurface();
 	setupSwapchain(width, height);
 	initFrameBuffer();
-	destroyCommands();
-	createCommands();
-	setupCommands();
-	mDevice.waitIdle();
+
+	if (mSwapchainBuffers.size() != imageCount)
+	{
+		// Command buffers are laid out per image, a new image count is rare enough to rebuild them the slow way
+		mDevice.waitIdle();
+		destroyCommands();
+		createCommands();
+	}
+
+	// Viewport and scissor are dynamic state, so recording picks up the new extent
+	std::fill(mCommandBufferDirty.begin(), mCommandBufferDirty.end(), true);
 
 	// Uniforms
-	uboVS.projectionMatrix = Matrix4::perspective(45.0f, (float)mViewport.width / (float)mViewport.height, 0.01f, 1024.0f);
+	mProjectionMatrix = Matrix4::perspective(45.0f, (float)mViewport.width / (float)mViewport.height, 0.01f, 1024.0f);
+}
+
+void Renderer::resetUniformRing(uint32_t frameIndex)
+{
+	mUniformRing.head = mUniformRing.frameSize * frameIndex;
+	mUniformRing.end = mUniformRing.head + mUniformRing.frameSize;
+}
+
+vk::DeviceSize Renderer::allocateUniforms(size_t size)
+{
+	vk::DeviceSize offset = mUniformRing.head;
+	vk::DeviceSize alignedSize = (size + mUniformRing.alignment - 1) & ~(mUniformRing.alignment - 1);
+	if (offset + alignedSize > mUniformRing.end)
+	{
+		throw std::runtime_error("uniform ring buffer is full!");
+	}
+
+	mUniformRing.head += alignedSize;
+	return offset;
 }
 
+uint32_t Renderer::pushUniforms(const void* data, size_t size)
+{
+	vk::DeviceSize offset = allocateUniforms(size);
+	memcpy(mUniformRing.mapped + offset, data, size);
+	return static_cast<uint32_t>(offset);
+}
+
+void Renderer::readTimestamps(uint32_t frameIndex)
+{
+	FrameData& frame = mFrames[frameIndex];
+	if (!frame.timestampsPending)
+	{
+		return;
+	}
+	frame.timestampsPending = false;
+
+	// The fence already signaled so these are available, no eWait means we never stall if they aren't
+	uint64_t timestamps[2];
+	vk::Result result = mDevice.getQueryPoolResults(
+		mTimestampQueryPool,
+		frameIndex * 2,
+		2,
+		sizeof(timestamps),
+		timestamps,
+		sizeof(uint64_t),
+		vk::QueryResultFlagBits::e64
+	);
+	if (result != vk::Result::eSuccess)
+	{
+		return;
+	}
+
+	// timestampPeriod is nanoseconds per tick
+	uint64_t ticks = (timestamps[1] - timestamps[0]) & mTimestampMask;
+	float milliseconds = static_cast<float>(static_cast<double>(ticks) * mTimestampPeriod * 1e-6);
+
+	// The GPU clock isn't calibrated against the CPU one, so the pass is placed at the start of the frame that submitted it
+	mProfiler.addGpuTime("Render Pass", 0.0f, milliseconds, static_cast<unsigned>(mProfiler.getFrameIndex() - frame.profilerFrame));
+}
+
+void Renderer::setReadbackCallback(const ReadbackCallback& callback)
+{
+	// Command buffers pick up or drop the copy as they're recorded again, right before their next submit
+	if (static_cast<bool>(callback) != static_cast<bool>(mReadbackCallback))
+	{
+		std::fill(mCommandBufferDirty.begin(), mCommandBufferDirty.end(), true);
+	}
+	mReadbackCallback = callback;
+}
+
+bool Renderer::hasReadback(size_t frameIndex) const
+{
+	const FrameData& frame = mFrames[frameIndex];
+	return mReadbackCallback && frame.readbackBuffer && frame.readbackExtent == mSurfaceSize;
+}
+
+void Renderer::createReadbackBuffer(uint32_t frameIndex)
+{
+	FrameData& frame = mFrames[frameIndex];
+	if (frame.readbackBuffer)
+	{
+		mDevice.destroyBuffer(frame.readbackBuffer);
+		mAllocator.free(frame.readbackMemory);
+	}
+
+	frame.readbackBuffer = mDevice.createBuffer(
+		vk::BufferCreateInfo(
+			vk::BufferCreateFlags(),
+			static_cast<vk::DeviceSize>(mSurfaceSize.width) * mSurfaceSize.height * 4,
+			vk::BufferUsageFlagBits::eTransferDst,
+			vk::SharingMode::eExclusive,
+			1,
+			&mQueueFamilyIndex
+		)
+	);
+
+	// The CPU reads every byte, which crawls through uncached memory, so prefer host cached memory where there is some
+	vk::MemoryRequirements memReqs = mDevice.getBufferMemoryRequirements(frame.readbackBuffer);
+	vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+	vk::PhysicalDeviceMemoryProperties memoryProperties = mPhysicalDevice.getMemoryProperties();
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+	{
+		vk::MemoryPropertyFlags cached = properties | vk::MemoryPropertyFlagBits::eHostCached;
+		if ((memReqs.memoryTypeBits & (1U << i)) && (memoryProperties.memoryTypes[i].propertyFlags & cached) == cached)
+		{
+			properties = cached;
+			break;
+		}
+	}
+
+	frame.readbackMemory = mAllocator.allocate(memReqs, properties);
+	mDevice.bindBufferMemory(frame.readbackBuffer, frame.readbackMemory.memory, frame.readbackMemory.offset);
+	frame.readbackExtent = mSurfaceSize;
+	frame.readbackPending = false;
+
+	for (size_t image = 0; image < mSwapchainBuffers.size(); ++image)
+	{
+		mCommandBufferDirty[frameIndex * mSwapchainBuffers.size() + image] = true;
+	}
+}
+
+void Renderer::recordReadback(vk::CommandBuffer& cmd, size_t frameIndex, size_t image)
+{
+	vk::Image colorImage = mSwapchainBuffers[image].image;
+	vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+	// The render pass leaves swapchain images ready to present and headless ones ready to copy from
+	vk::ImageLayout finalLayout = mHeadless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+
+	vk::ImageMemoryBarrier toTransfer(
+		vk::AccessFlagBits::eColorAttachmentWrite,
+		vk::AccessFlagBits::eTransferRead,
+		finalLayout,
+		vk::ImageLayout::eTransferSrcOptimal,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		colorImage,
+		range
+	);
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+	// Rows are tightly packed
+	vk::BufferImageCopy region(
+		0,
+		0,
+		0,
+		vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+		vk::Offset3D(0, 0, 0),
+		vk::Extent3D(mSurfaceSize.width, mSurfaceSize.height, 1)
+	);
+	cmd.copyImageToBuffer(colorImage, vk::ImageLayout::eTransferSrcOptimal, mFrames[frameIndex].readbackBuffer, 1, &region);
+
+	vk::ImageMemoryBarrier toFinal(
+		vk::AccessFlagBits::eTransferRead,
+		vk::AccessFlags(),
+		vk::ImageLayout::eTransferSrcOptimal,
+		finalLayout,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		colorImage,
+		range
+	);
+
+	// Make the copy visible to the host once the frame's fence signals
+	vk::BufferMemoryBarrier toHost(
+		vk::AccessFlagBits::eTransferWrite,
+		vk::AccessFlagBits::eHostRead,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		mFrames[frameIndex].readbackBuffer,
+		0,
+		VK_WHOLE_SIZE
+	);
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost | vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), 0, nullptr, 1, &toHost, 1, &toFinal);
+}
+
+void Renderer::deliverReadback(uint32_t frameIndex)
+{
+	FrameData& frame = mFrames[frameIndex];
+	if (!frame.readbackPending)
+	{
+		return;
+	}
+	frame.readbackPending = false;
+
+	if (!mReadbackCallback || frame.readbackMemory.mapped == nullptr)
+	{
+		return;
+	}
+
+	ProfileScope scope(mProfiler, "Readback");
+
+	ReadbackImage image;
+	image.frame = frame.profilerFrame;
+	image.width = frame.readbackExtent.width;
+	image.height = frame.readbackExtent.height;
+	image.rowPitch = static_cast<size_t>(image.width) * 4;
+	isReadbackFormat(mSurfaceColorFormat, image.bgra);
+	image.pixels = frame.readbackMemory.mapped;
+	mReadbackCallback(image);
+}
+
+void Renderer::createPipelineCache()
+{
+	std::vector<char> cacheData;
+
+	if (!mDesc.pipelineCachePath.empty())
+	{
+		try
+		{
+			cacheData = readFile(mDesc.pipelineCachePath);
+		}
+		catch (const std::runtime_error&)
+		{
+			// First launch, nothing cached yet
+		}
+
+		if (!isPipelineCacheCompatible(cacheData, mPhysicalDevice.getProperties()))
+		{
+			cacheData.clear();
+		}
+	}
+
+	mPipelineCache = mDevice.createPipelineCache(
+		vk::PipelineCacheCreateInfo(
+			vk::PipelineCacheCreateFlags(),
+			cacheData.size(),
+			cacheData.data()
+		)
+	);
+}
+
+void Renderer::savePipelineCache()
+{
+	if (mDesc.pipelineCachePath.empty())
+	{
+		return;
+	}
+
+	std::vector<uint8_t> cacheData = mDevice.getPipelineCacheData(mPipelineCache);
+
+	try
+	{
+		writeFile(mDesc.pipelineCachePath, cacheData.data(), cacheData.size());
+	}
+	catch (const std::runtime_error&)
+	{
+		// Read only working directory, we'll just compile pipelines again next launch
+	}
+}
@@ -1,8 +1,243 @@
 #include "CrossWindow/CrossWindow.h"
 #include "Renderer.h"
+#include "EventCoalescer.h"
+
+// 🖱️ Events the user caused, the ones input to photon latency is measured from
+bool isInputEvent(xwin::EventType type)
+{
+    switch (type)
+    {
+    case xwin::EventType::Keyboard:
+    case xwin::EventType::MouseMove:
+    case xwin::EventType::MouseRaw:
+    case xwin::EventType::MouseWheel:
+    case xwin::EventType::MouseInput:
+    case xwin::EventType::Touch:
+    case xwin::EventType::Gamepad:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 📊 Print frame time percentiles, and write the timings out if a path was given
+void reportProfile(Renderer& renderer, const std::string& profilePath)
+{
+    const FrameProfiler& profiler = renderer.getProfiler();
+    FrameStats stats = profiler.getStats();
+    std::cout << "Frame time over the last " << stats.frameCount << " frames: avg " << stats.average
+              << " ms, p50 " << stats.p50 << " ms, p95 " << stats.p95 << " ms, p99 " << stats.p99
+              << " ms, max " << stats.maximum << " ms\n";
+
+    // 🖱️ Input to photon latency, over the frames that were the first to show new input
+    auto reportLatency = [](const char* what, const FrameStats& latency)
+    {
+        if (latency.frameCount > 0)
+        {
+            std::cout << "Input to " << what << " latency over " << latency.frameCount << " frames: avg " << latency.average
+                      << " ms, p50 " << latency.p50 << " ms, p95 " << latency.p95 << " ms, p99 " << latency.p99
+                      << " ms, max " << latency.maximum << " ms\n";
+        }
+    };
+    reportLatency("present", renderer.getLatencyTracker().getPresentStats());
+    reportLatency("display", renderer.getLatencyTracker().getDisplayStats());
+
+    // Only backends with GPU timestamps report these, they're the tell for being GPU bound
+    for (const std::string& name : profiler.getEventNames())
+    {
+        if (name.compare(0, 4, "GPU ") == 0)
+        {
+            std::cout << name << ": avg " << profiler.getAverageTime(name) << " ms\n";
+        }
+    }
+
+#if defined(XGFX_VULKAN)
+    DeviceMemoryStats memory = renderer.getDeviceMemoryStats();
+    std::cout << "Device memory: " << memory.allocationCount << " allocations using " << memory.usedBytes / 1024
+              << " KiB of " << memory.blockCount << " blocks totalling " << memory.blockBytes / 1024 << " KiB\n";
+#endif
+
+#if defined(XGFX_OPENGL)
+    PipelineStatistics statistics;
+    if (renderer.getPipelineStatistics(statistics))
+    {
+        std::cout << "Pipeline statistics of the last frame: " << statistics.verticesSubmitted << " vertices, "
+                  << statistics.primitivesSubmitted << " primitives, " << statistics.vertexShaderInvocations
+                  << " vertex shader invocations, " << statistics.clippingInputPrimitives << " / "
+                  << statistics.clippingOutputPrimitives << " primitives in / out of clipping, "
+                  << statistics.fragmentShaderInvocations << " fragment shader invocations\n";
+    }
+#endif
+
+    if (!profilePath.empty())
+    {
+        if (!profiler.exportCSV(profilePath + ".csv") || !profiler.exportChromeTrace(profilePath + ".json"))
+        {
+            std::cout << "Failed to write profile to " << profilePath << ".csv / .json\n";
+        }
+    }
+}
+
+#if defined(XGFX_VULKAN) || defined(XGFX_OPENGL)
+// 📷 Continuous capture, copies out every frame read back as a visual check or thumbnail writer would
+struct Capture
+{
+    unsigned frameCount = 0;
+    uint64_t byteCount = 0;
+    uint64_t framesLate = 0;
+    std::vector<uint8_t> pixels;
+    std::chrono::steady_clock::time_point start;
+};
+
+void startCapture(Renderer& renderer, Capture& capture)
+{
+    capture.start = std::chrono::steady_clock::now();
+    renderer.setReadbackCallback([&renderer, &capture](const ReadbackImage& image)
+    {
+        size_t size = image.rowPitch * image.height;
+        capture.pixels.assign(image.pixels, image.pixels + size);
+        capture.frameCount++;
+        capture.byteCount += size;
+        capture.framesLate += renderer.getProfiler().getFrameIndex() - image.frame;
+    });
+}
+
+void reportCapture(Renderer& renderer, const Capture& capture)
+{
+    renderer.setReadbackCallback(ReadbackCallback());
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - capture.start).count();
+    float megabytes = static_cast<float>(capture.byteCount) / (1024.0f * 1024.0f);
+    unsigned frames = std::max(capture.frameCount, 1u);
+    std::cout << "Captured " << capture.frameCount << " frames (" << megabytes << " MB) in " << seconds << " s: "
+              << static_cast<float>(capture.frameCount) / seconds << " frames/s, " << megabytes / seconds << " MB/s, delivered "
+              << static_cast<float>(capture.framesLate) / static_cast<float>(frames) << " frames after rendering on average\n";
+}
+
+// 🕶️ Render a fixed number of frames offscreen, no window or display needed
+void runHeadless(RendererDesc rendererDesc, unsigned frameCount, const std::string& profilePath, bool capturing)
+{
+    // Uncapped, so the timings measure the renderer rather than the frame pacer
+    rendererDesc.targetFrameRate = 0.0f;
+    Renderer renderer(rendererDesc);
+
+    Capture capture;
+    if (capturing)
+    {
+        startCapture(renderer, capture);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < frameCount; ++i)
+    {
+        renderer.render();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    float totalTime = std::chrono::duration<float, std::milli>(end - start).count();
+    std::cout << "Rendered " << frameCount << " headless frames in " << totalTime << " ms ("
+              << totalTime / static_cast<float>(std::max(frameCount, 1u)) << " ms per frame)\n";
+
+    if (capturing)
+    {
+        reportCapture(renderer, capture);
+    }
+    reportProfile(renderer, profilePath);
+}
+#endif
 
 void xmain(int argc, const char** argv)
 {
+    // ⚙️ Benchmark options
+    // `--profile <path>` writes <path>.csv and a Chrome trace <path>.json on exit
+    // `--resolution <width>x<height>` sizes the window / offscreen images, such as 3840x2160
+    // `--offscreen` renders through an offscreen frame buffer as post processing would (OpenGL)
+    // `--uncapped` turns off the frame pacer
+    // `--draws <count>` fills the scene with that many objects (Vulkan, OpenGL)
+    // `--recording-threads <count>` records the draws' command buffers on that many threads (Vulkan)
+    // `--instances <count>` draws that many triangles with one instanced draw instead (Vulkan, OpenGL)
+    // `--pipeline-statistics` counts vertices, primitives and shader invocations (OpenGL)
+    // `--capture` reads every frame back to the CPU and reports the throughput (Vulkan, OpenGL)
+    // `--hot-reload` recompiles and swaps in shaders as they're saved (Vulkan, OpenGL)
+    // `--latency` measures input to photon latency (Vulkan, OpenGL)
+    // `--present-mode <fifo|mailbox|immediate>` picks the swapchain present mode, such as to compare latencies (Vulkan)
+    RendererDesc rendererDesc;
+    std::string profilePath;
+    bool capturing = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--profile" && i + 1 < argc)
+        {
+            profilePath = argv[++i];
+        }
+        else if (arg == "--resolution" && i + 1 < argc)
+        {
+            std::string resolution = argv[++i];
+            size_t x = resolution.find('x');
+            if (x != std::string::npos)
+            {
+                rendererDesc.width = static_cast<unsigned>(std::stoul(resolution.substr(0, x)));
+                rendererDesc.height = static_cast<unsigned>(std::stoul(resolution.substr(x + 1)));
+            }
+        }
+        else if (arg == "--offscreen")
+        {
+            rendererDesc.offscreenFrameBuffer = true;
+        }
+        else if (arg == "--uncapped")
+        {
+            rendererDesc.targetFrameRate = 0.0f;
+        }
+        else if (arg == "--draws" && i + 1 < argc)
+        {
+            rendererDesc.drawCount = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--recording-threads" && i + 1 < argc)
+        {
+            rendererDesc.recordingThreads = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--instances" && i + 1 < argc)
+        {
+            rendererDesc.instanceCount = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--pipeline-statistics")
+        {
+            rendererDesc.pipelineStatistics = true;
+        }
+        else if (arg == "--capture")
+        {
+            capturing = true;
+        }
+        else if (arg == "--hot-reload")
+        {
+            rendererDesc.shaderHotReload = true;
+        }
+        else if (arg == "--latency")
+        {
+            rendererDesc.measureLatency = true;
+        }
+        else if (arg == "--present-mode" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            rendererDesc.presentMode = mode == "fifo" ? PresentMode::Fifo : (mode == "immediate" ? PresentMode::Immediate : PresentMode::Mailbox);
+        }
+    }
+
+#if defined(XGFX_VULKAN) || defined(XGFX_OPENGL)
+    // 🕶️ `--headless [frames]` renders without a window, such as on CI or benchmark servers
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--headless")
+        {
+            bool hasCount = i + 1 < argc && argv[i + 1][0] != '-';
+            unsigned frameCount = hasCount ? static_cast<unsigned>(std::stoul(argv[i + 1])) : 1000u;
+            runHeadless(rendererDesc, frameCount, profilePath, capturing);
+            return;
+        }
+    }
+#endif
+
     // 🖼️ Create a window
     xwin::EventQueue eventQueue;
     xwin::Window window;
@@ -11,44 +246,58 @@ void xmain(int argc, const char** argv)
     windowDesc.name = "MainWindow";
     windowDesc.title = "Hello Triangle";
     windowDesc.visible = true;
-    windowDesc.width = 1280;
-    windowDesc.height = 720;
+    windowDesc.width = rendererDesc.width;
+    windowDesc.height = rendererDesc.height;
     //windowDesc.fullscreen = true;
     window.create(windowDesc, eventQueue);
 
     // 📸 Create a renderer
-    Renderer renderer(window);
+    Renderer renderer(window, rendererDesc);
+
+#if defined(XGFX_VULKAN) || defined(XGFX_OPENGL)
+    Capture capture;
+    if (capturing)
+    {
+        startCapture(renderer, capture);
+    }
+#endif
 
     // 🏁 Engine loop
+    EventCoalescer eventCoalescer;
     bool isRunning = true;
     while (isRunning)
     {
         bool shouldRender = true;
 
-        // ♻️ Update the event queue
-        eventQueue.update();
-
-        // 🎈 Iterate through that queue:
-        while (!eventQueue.empty())
         {
-            //Update Events
-            const xwin::Event& event = eventQueue.front();
+            ProfileScope scope(renderer.getProfiler(), "Event Pump");
 
-            if (event.type == xwin::EventType::Resize)
-            {
-                const xwin::ResizeData data = event.data.resize;
-                renderer.resize(data.width, data.height);
-                shouldRender = false;
-            }
+            // ♻️ Update the event queue, input is timestamped as it reaches the app
+            eventQueue.update();
+            LatencyTracker::Clock::time_point pumpTime = LatencyTracker::Clock::now();
 
-            if (event.type == xwin::EventType::Close)
+            // 🎈 Iterate through that queue, a burst of resizes rebuilds the swapchain once
+            for (const xwin::Event& event : eventCoalescer.drain(eventQueue))
             {
-                window.close();
-                shouldRender = false;
-                isRunning = false;
-            }
+                if (isInputEvent(event.type))
+                {
+                    renderer.getLatencyTracker().addInput(pumpTime);
+                }
+
+                if (event.type == xwin::EventType::Resize)
+                {
+                    const xwin::ResizeData data = event.data.resize;
+                    renderer.resize(data.width, data.height);
+                    shouldRender = false;
+                }
 
-            eventQueue.pop();
+                if (event.type == xwin::EventType::Close)
+                {
+                    window.close();
+                    shouldRender = false;
+                    isRunning = false;
+                }
+            }
         }
 
         // ✨ Update Visuals
@@ -58,4 +307,11 @@ void xmain(int argc, const char** argv)
         }
     }
 
+#if defined(XGFX_VULKAN) || defined(XGFX_OPENGL)
+    if (capturing)
+    {
+        reportCapture(renderer, capture);
+    }
+#endif
+    reportProfile(renderer, profilePath);
 }
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "CrossWindow/CrossWindow.h"
+
+#include <vector>
+#include <cstddef>
+
+// Event Coalescer
+
+/**
+ * Drains an xwin::EventQueue once per frame, merging high frequency events so a frame handles fewer of them.
+ * A run of back to back MouseMove, MouseWheel or Resize events of the same type for a window becomes a single
+ * event: moves keep the latest position and add up their deltas, wheel deltas add up and resizes keep the
+ * latest size. Any other event, including one of the other mergeable types, ends the run, so every event is
+ * handled in the order it came in and a click always sees the cursor where it was clicked.
+ */
+class EventCoalescer
+{
+public:
+	// Pop every event in the queue, returns them merged and in order, valid until the next call
+	const std::vector<xwin::Event>& drain(xwin::EventQueue& queue)
+	{
+		mEvents.clear();
+		mPoppedCount = 0;
+
+		while (!queue.empty())
+		{
+			const xwin::Event& event = queue.front();
+			++mPoppedCount;
+
+			// Only the event just before can be merged into, so nothing is ever reordered
+			if (isMergeable(event.type) && !mEvents.empty() && mEvents.back().type == event.type &&
+				mEvents.back().window == event.window)
+			{
+				merge(mEvents.back(), event);
+			}
+			else
+			{
+				mEvents.push_back(event);
+			}
+
+			queue.pop();
+		}
+
+		return mEvents;
+	}
+
+	// Events popped from the queue by the last drain, before merging
+	size_t getPoppedCount() const
+	{
+		return mPoppedCount;
+	}
+
+protected:
+	static bool isMergeable(xwin::EventType type)
+	{
+		switch (type)
+		{
+		case xwin::EventType::MouseMove:
+		case xwin::EventType::MouseWheel:
+		case xwin::EventType::Resize:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	static void merge(xwin::Event& merged, const xwin::Event& event)
+	{
+		switch (event.type)
+		{
+		case xwin::EventType::MouseMove:
+		{
+			int deltax = merged.data.mouseMove.deltax + event.data.mouseMove.deltax;
+			int deltay = merged.data.mouseMove.deltay + event.data.mouseMove.deltay;
+			merged.data.mouseMove = event.data.mouseMove;
+			merged.data.mouseMove.deltax = deltax;
+			merged.data.mouseMove.deltay = deltay;
+			break;
+		}
+		case xwin::EventType::MouseWheel:
+			merged.data.mouseWheel.delta += event.data.mouseWheel.delta;
+			break;
+		case xwin::EventType::Resize:
+			merged.data.resize = event.data.resize;
+			break;
+		default:
+			break;
+		}
+	}
+
+	std::vector<xwin::Event> mEvents;
+	size_t mPoppedCount = 0;
+};